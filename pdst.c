@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <math.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +13,17 @@
 #include <stdint.h>
 #endif
 
+/* Memory reclamation can use helper threads unless told not to. */
+#if defined(L2_SMALLTALK_EMBEDDED) && !defined(L2_SMALLTALK_NO_THREADS)
+#define L2_SMALLTALK_NO_THREADS
+#endif
+
+#ifndef L2_SMALLTALK_NO_THREADS
+#include <atomic>
+#include <mutex>
+#include <thread>
+#endif
+
 #ifdef L2_SMALLTALK_EMBEDDED
 #define setjmp(x)	0
 typedef struct {} jmp_buf;
@@ -76,21 +88,37 @@ Some kinds of objects are small enough and used often enough that it can
 be worthwhile to tightly encode the entire representation (both a class
 reference and a value).  We refer to them using "encoded values" and
 treat a subset of the host's signed integer range this way.
+
+Every object reference takes up exactly one host word.  The low refTagBits
+bits of the word are a "tag" telling what kind of reference it is, and the
+remaining bits hold its datum.  Encoded values are tagged valTag, so they
+are 62 bits wide on 64-bit hosts (30 bits on 32-bit ones).  Encoded
+Floats (see newFloat) are tagged fltTag.
 */
+typedef intptr_t refWord;
+
+#define refTagBits 2
+#define refTagMask 3
+#define ptrTag     0
+#define valTag     1
+#define fltTag     2
+
+#define encValueLit(x) { ((refWord)(x) << refTagBits) | valTag }
+#define encIndexLit(x) { ((refWord)(x) << refTagBits) | ptrTag }
+
 typedef struct {
-    bool flg;// : 1; /* true */
-    int32_t  dat;// : 31;
+    refWord wrd;
 } encVal;
 
-__INLINE__ encVal encValueOf(int x)
+__INLINE__ encVal encValueOf(long x)
 {
-    encVal ans = { true,x };
+    encVal ans = { (refWord)((uintptr_t)x << refTagBits) | valTag };
     return(ans);
 }
 
-__INLINE__ int intValueOf(encVal x)
+__INLINE__ long intValueOf(encVal x)
 {
-    return(x.dat);
+    return(x.wrd >> refTagBits);
 }
 
 /*
@@ -98,7 +126,7 @@ The safest and easiest way to find out if a value can be embedded
 (encoded) without losing information is to try it and test whether or
 not it works.
 */
-__INLINE__ bool canEmbed(int x)
+__INLINE__ bool canEmbed(long x)
 {
     return(intValueOf(encValueOf(x)) == x);
 }
@@ -109,96 +137,118 @@ by other means.  We refer to them using "encoded pointers" and treat the
 datum as an index into an "object table".
 */
 typedef struct {
-    bool flg;// : 1;
-    word_t dat;// : 31;
-    //bool flg : 1; /* false */
-    //word_t dat : 31;
+    refWord wrd;
 } encPtr;
 
 __INLINE__ encPtr encIndexOf(word_t x)
 {
-    encPtr ans = { false,x };
+    encPtr ans = { ((refWord)x << refTagBits) | ptrTag };
     return(ans);
 }
 
 __INLINE__ word_t oteIndexOf(encPtr x)
 {
-    return(x.dat);
+    return((word_t)(x.wrd >> refTagBits));
 }
 
 /*
 Any part of an object representation that isn't kept in either an
 encoded value or an object table entry is kept elsewhere in the host's
 main memory.  We call that part of the object "von Neumann space" and
-keep a pointer to it.  Mapping between field counts and address units is
-done using a scale factor expressed as a shift count.  We distinguish
-between objects whose fields do or don't contain object references.  We
-distinguish between objects whose fields have or haven't been traced.
-We call objects which might not be transitively accessible from any root
-object(s) "volatile".  Within the object table, we distinguish between
-entries that are or aren't available.
+keep a pointer to it.  We keep track of how large a given von Neumann
+space is in address units.  This "space count" is used along with a
+scale factor (expressed as a shift count) to derive a field count, among
+other things.  We also need to keep track of the class of which a given
+object is an instance.  The interpreter usually wants the space, its
+size and the class together, so they're kept side by side in the entry.
+
+The rest of what we know about an object is kept as bits in one byte_t
+of its entry.  We distinguish between objects whose fields do or don't
+contain object references.  Within the object table, we distinguish
+between entries that are or aren't available.  We call objects which
+have been allocated since the last scavenge (q.v.) "young", and we
+distinguish between objects which have or haven't been remembered as
+possibly referring to young or unmarked ones.  Young objects are traced
+by a scavenge separately from the marking of the whole table, so that
+the two can be under way at the same time.  We also note which objects
+are registered for finalization (see finalList).  The scale factor never
+exceeds three, so it only needs two bits.
+
+Whether or not an object has been traced by marking is kept apart from
+its entry, in a bitmap with one bit per entry (see isMarked), so that
+marking and sweeping touch as little memory as possible.
 */
 typedef struct {
-    addr vnspc;
-    word_t shift;// : 3;
-    bool orefs;// : 1;
-    bool mrked;// : 1;
-    bool voltl;// : 1;
-    bool avail;// : 1;
-    //word_t : 25;
+    addr   vnspc;
+    word_t spcct;
+    word_t clsix;
+    byte_t flags;
 } otbEnt;
 
+#define spaceLimit 0x7FFFFFFF	/* bytes a spcct can count */
+
+#define otbScale      0x03
+#define otbFinal      0x04
+#define otbObjRefs    0x08
+#define otbAvail      0x10
+#define otbYoung      0x20
+#define otbRemembered 0x40
+#define otbScavenged  0x80
+
 /*
-We keep track of how large a given von Neumann space is in address
-units.  This "space count" is used along with the scale factor to derive
-a field count, among other things.  We also need to keep track of the
-class of which a given object is an instance.
+The object table starts out with room for a modest number of entries.
+Whenever the free list can't keep up with demand, even after memory
+reclamation, the table is extended by at least another chunk.  Entry
+indices are kept in a full word_t, so the table isn't limited to the
+65,536 entries of the original 16-bit design.
 */
-typedef struct {
-    word_t   spcct;
-    encPtr classPtr;
-} ot2Ent;
-
 #define otbLob     0
-#define otbHib 65535
+#define otbChunk 65536
+#define otbLimit 0x7FFFFFFF
+word_t otbHib = otbChunk - 1;
 #define otbDom ((otbHib + 1) - otbLob)
 
 otbEnt* objTbl = NULL;
 /*otbEnt objTbl[otbDom];*/
 
-ot2Ent* ob2Tbl = NULL;
-/*ot2Ent ob2Tbl[otbDom];*/
+uint32_t* markBits = NULL;
+#define markBitsDom(dom) (((size_t)(dom) + 31) / 32)
 
 /*
 An object reference is either an encoded value or an encoded pointer.
-We distinguish one from the other by means of the flag (q.v.) defined in
-both.  N.B.:  This kind of overlay definition would be safer and easier
-both to specify and to use if compilers would pack a 1-bit flag and a
-<wordSize-1>-bit union (resp. field) into a <wordSize>-bit struct.
+We distinguish one from the other by means of the tag (q.v.) kept in the
+low bits of both, so that identity is a single comparison of host words.
 */
 typedef union {
     encVal val;
     encPtr ptr;
 } objRef;
 
+#define orefScale (sizeof(objRef) == 8 ? 3 : 2)
+
 __INLINE__ bool isValue(objRef x)
 {
-    return(x.val.flg == true);
+    return((x.val.wrd & refTagMask) == valTag);
 }
 
 __INLINE__ bool isIndex(objRef x)
 {
-    return(x.ptr.flg == false);
+    return((x.ptr.wrd & refTagMask) == ptrTag);
+}
+
+__INLINE__ bool isFloatRef(objRef x)
+{
+    return((x.ptr.wrd & refTagMask) == fltTag);
 }
 
 __INLINE__ bool ptrEq(objRef x, objRef y)
 {
-    return(x.ptr.flg == y.ptr.flg && x.ptr.dat == y.ptr.dat);
+    return(x.ptr.wrd == y.ptr.wrd);
 }
 
 __INLINE__ bool ptrNe(objRef x, objRef y)
 {
-    return(x.ptr.flg != y.ptr.flg || x.ptr.dat != y.ptr.dat);
+    return(x.ptr.wrd != y.ptr.wrd);
 }
 
 __INLINE__ addr addressOf(encPtr x)
@@ -211,69 +261,179 @@ __INLINE__ void addressOfPut(encPtr x, addr v)
     objTbl[oteIndexOf(x)].vnspc = v;
 }
 
+__INLINE__ bool flagOf(encPtr x, byte_t f)
+{
+    return((objTbl[oteIndexOf(x)].flags & f) != 0);
+}
+
+__INLINE__ void flagOfPut(encPtr x, byte_t f, bool v)
+{
+    if (v)
+        objTbl[oteIndexOf(x)].flags |= f;
+    else
+        objTbl[oteIndexOf(x)].flags &= ~f;
+}
+
 __INLINE__ word_t scaleOf(encPtr x)
 {
-    return(objTbl[oteIndexOf(x)].shift);
+    return(objTbl[oteIndexOf(x)].flags & otbScale);
 }
 
 __INLINE__ void scaleOfPut(encPtr x, word_t v)
 {
-    objTbl[oteIndexOf(x)].shift = v;
+    otbEnt* e = &objTbl[oteIndexOf(x)];
+    e->flags = (byte_t)((e->flags & ~otbScale) | v);
 }
 
 __INLINE__ bool isObjRefs(encPtr x)
 {
-    return(objTbl[oteIndexOf(x)].orefs == true);
+    return(flagOf(x, otbObjRefs));
 }
 
 __INLINE__ void isObjRefsPut(encPtr x, bool v)
 {
-    objTbl[oteIndexOf(x)].orefs = v;
+    flagOfPut(x, otbObjRefs, v);
 }
 
 __INLINE__ bool isMarked(encPtr x)
 {
-    return(objTbl[oteIndexOf(x)].mrked == true);
+    word_t i = oteIndexOf(x);
+    return((markBits[i >> 5] >> (i & 31)) & 1);
 }
 
 __INLINE__ void isMarkedPut(encPtr x, bool v)
 {
-    objTbl[oteIndexOf(x)].mrked = v;
+    word_t i = oteIndexOf(x);
+    if (v)
+        markBits[i >> 5] |= (uint32_t)1 << (i & 31);
+    else
+        markBits[i >> 5] &= ~((uint32_t)1 << (i & 31));
+}
+
+__INLINE__ bool isAvail(encPtr x)
+{
+    return(flagOf(x, otbAvail));
 }
 
-__INLINE__ bool isVolatile(encPtr x)
+__INLINE__ void isAvailPut(encPtr x, bool v)
 {
-    return(objTbl[oteIndexOf(x)].voltl == true);
+    flagOfPut(x, otbAvail, v);
 }
 
-__INLINE__ void isVolatilePut(encPtr x, bool v)
+__INLINE__ bool isYoung(encPtr x)
 {
-    objTbl[oteIndexOf(x)].voltl = v;
+    return(flagOf(x, otbYoung));
 }
 
-__INLINE__ bool isAvail(encPtr x)
+__INLINE__ void isYoungPut(encPtr x, bool v)
 {
-    return(objTbl[oteIndexOf(x)].avail == true);
+    flagOfPut(x, otbYoung, v);
 }
 
-__INLINE__ void isAvailPut(encPtr x, bool v)
+__INLINE__ bool isRemembered(encPtr x)
+{
+    return(flagOf(x, otbRemembered));
+}
+
+__INLINE__ void isRememberedPut(encPtr x, bool v)
+{
+    flagOfPut(x, otbRemembered, v);
+}
+
+__INLINE__ bool isScavenged(encPtr x)
+{
+    return(flagOf(x, otbScavenged));
+}
+
+__INLINE__ void isScavengedPut(encPtr x, bool v)
+{
+    flagOfPut(x, otbScavenged, v);
+}
+
+__INLINE__ bool isFinal(encPtr x)
+{
+    return(flagOf(x, otbFinal));
+}
+
+__INLINE__ void isFinalPut(encPtr x, bool v)
+{
+    flagOfPut(x, otbFinal, v);
+}
+
+/*
+Several parts of memory management need an unbounded list of object
+table entries kept in host memory.
+*/
+typedef struct {
+    encPtr* ptrs;
+    word_t  top;
+    word_t  max;
+} ptrList;
+
+void ptrListGrow(ptrList* l)
+{
+    l->max = l->max ? l->max * 2 : 1024;
+    l->ptrs = (encPtr*) realloc(l->ptrs, (size_t)l->max * sizeof(encPtr));
+    assert(l->ptrs != NULL);
+}
+
+__INLINE__ void ptrListPush(ptrList* l, encPtr x)
+{
+    if (l->top == l->max)
+        ptrListGrow(l);
+    l->ptrs[l->top++] = x;
+}
+
+/*
+Objects that aren't young but might refer to young ones are kept in the
+"remembered set".  Every store of a reference into an object goes
+through this write barrier, which remembers the object stored into.
+The barrier looks only at that object's entry, not at the entry of the
+object being stored, which is likely to be elsewhere in the table.
+
+The same barrier serves marking which is spread over several interpreter
+time slices (see markStep).  Objects are "white" while unmarked, "grey"
+once marked but still on the mark stack and "black" once their fields
+have been traced.  While marking is under way, marked objects which are
+stored into are remembered as well, and their fields are traced again
+before marking finishes, so that no black object can come to refer to a
+white one behind the marker's back.
+*/
+ptrList rememberedSet = { NULL,0,0 };
+ptrList markStack = { NULL,0,0 };
+bool marking = false;
+word_t markCount = 0;
+
+__INLINE__ void shade(encPtr x)
+{
+    if (!isMarked(x)) {
+        isMarkedPut(x, true);
+        markCount++;
+        ptrListPush(&markStack, x);
+    }
+}
+
+__INLINE__ void writeBarrier(encPtr x)
 {
-    objTbl[oteIndexOf(x)].avail = v;
+    if (!isRemembered(x) && (!isYoung(x) || (marking && isMarked(x)))) {
+        isRememberedPut(x, true);
+        ptrListPush(&rememberedSet, x);
+    }
 }
 
 __INLINE__ word_t spaceOf(encPtr x)
 {
-    return(ob2Tbl[oteIndexOf(x)].spcct);
+    return(objTbl[oteIndexOf(x)].spcct);
 }
 
 __INLINE__ void spaceOfPut(encPtr x, word_t v)
 {
-    ob2Tbl[oteIndexOf(x)].spcct = v;
+    objTbl[oteIndexOf(x)].spcct = v;
 }
 
 __INLINE__ encPtr classOf(encPtr x)
 {
-    return(ob2Tbl[oteIndexOf(x)].classPtr);
+    return(encIndexOf(objTbl[oteIndexOf(x)].clsix));
 }
 
 __INLINE__ void classOfPut(encPtr x, encPtr v)
@@ -281,8 +441,8 @@ __INLINE__ void classOfPut(encPtr x, encPtr v)
 #if 0
     assert(isIndex(v));
 #endif
-    isVolatilePut(v, false);
-    ob2Tbl[oteIndexOf(x)].classPtr = v;
+    writeBarrier(x);
+    objTbl[oteIndexOf(x)].clsix = oteIndexOf(v);
 }
 
 __INLINE__ word_t countOf(encPtr x)
@@ -298,7 +458,7 @@ __INLINE__ objRef orefOf(encPtr x, word_t i)
 __INLINE__ void orefOfPut(encPtr x, word_t i, objRef v)
 {
     if (isIndex(v))
-        isVolatilePut(v.ptr, false);
+        writeBarrier(x);
     ((objRef*)objTbl[oteIndexOf(x)].vnspc)[i - 1] = v;
 }
 
@@ -334,6 +494,12 @@ __INLINE__ void wordOfPut(encPtr x, word_t i, word_t v)
 
 #define pointerList encIndexOf(0)
 
+/*
+We count the entries on the free list as they come and go, so that we
+can tell when it's running low without walking it.
+*/
+word_t pointersAvail = 0;
+
 int availCount(void)
 {
     int ans = 0;
@@ -345,18 +511,30 @@ int availCount(void)
     return(ans);
 }
 
+/*
+Available entries are chained through their class pointers.  The chain
+isn't made of object references, so it bypasses the write barrier.
+*/
+__INLINE__ void nextFreePut(encPtr x, encPtr v)
+{
+    objTbl[oteIndexOf(x)].clsix = oteIndexOf(v);
+}
+
+__INLINE__ void clearPointer(encPtr x)
+{
+    isMarkedPut(x, false);
+    objTbl[oteIndexOf(x)].flags = otbAvail;
+}
+
 void freePointer(encPtr x)
 {
 #if 0
     assert(false);
 #endif
-    scaleOfPut(x, 0);
-    isObjRefsPut(x, false);
-    isMarkedPut(x, false);
-    isVolatilePut(x, false);
-    isAvailPut(x, true);
-    classOfPut(x, classOf(pointerList));
-    classOfPut(pointerList, x);
+    clearPointer(x);
+    nextFreePut(x, classOf(pointerList));
+    nextFreePut(pointerList, x);
+    pointersAvail++;
 }
 
 void freeStorage(addr x)
@@ -371,91 +549,1505 @@ void freeStorage(addr x)
     free(x);
 }
 
+/*
+The von Neumann space of objects is carved out of large "arenas" which
+are obtained from the host in one piece.  Space is usually handed out
+by bumping a pointer through the current arena.  Space given back by
+memory reclamation is kept on free lists segregated by size and handed
+out again before any more is bumped.  Each arena keeps track of how much
+of it is in use, so an arena that no longer holds any live objects can
+be given back to the host all at once rather than object by object.
+Spaces too large to be worth segregating are obtained from the host
+individually.  Arenas are aligned on their own size, which lets us find
+the arena holding a given space by masking its address.
+*/
+#define spcGrain 8
+#define arenaBytes (1 << 20)
+#define arenaLargest 1024
+#define arenaClasses ((arenaLargest / spcGrain) + 1)
+#define arenaSpares 2
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#define hostArenaAlloc() _aligned_malloc(arenaBytes, arenaBytes)
+#define hostArenaFree(x) _aligned_free(x)
+#else
+#define hostArenaAlloc() aligned_alloc(arenaBytes, arenaBytes)
+#define hostArenaFree(x) free(x)
+#endif
+
+typedef struct arenaHdr {
+    struct arenaHdr* next;
+    byte_t* base;		/* first address unit available for spaces */
+    byte_t* top;		/* next address unit to bump */
+    long    live;		/* address units in use, or -1 if released */
+} arenaHdr;
+
+arenaHdr* arenaList = NULL;
+arenaHdr* arenaSpare = NULL;
+arenaHdr* arenaCur = NULL;
+int arenaSpareCount = 0;
+
+addr spaceFree[arenaClasses];
+
+/*
+We keep count of the address units held by spaces outside the nursery,
+including those still held by garbage which hasn't been swept yet, and
+of those asked for by new objects since the last collection.
+*/
+size_t heapBytes = 0;
+size_t allocBytes = 0;
+
+/*
+Young objects small enough to live in an arena get their von Neumann
+space from the "nursery" instead.  That's a single region which space is
+bumped through and which is emptied all at once by each scavenge.
+*/
+#define nurseryBytes (1 << 20)
+
+byte_t* nurseryBase = NULL;
+byte_t* nurseryTop = NULL;
+byte_t* nurseryEnd = NULL;
+
+__INLINE__ bool inNursery(addr x)
+{
+    return((byte_t*)x >= nurseryBase && (byte_t*)x < nurseryEnd);
+}
+
+__INLINE__ word_t spaceRound(word_t bytes)
+{
+    return((bytes + (spcGrain - 1)) & ~(spcGrain - 1));
+}
+
+__INLINE__ arenaHdr* arenaOf(addr x)
+{
+    return((arenaHdr*)((uintptr_t)x & ~(uintptr_t)(arenaBytes - 1)));
+}
+
+__INLINE__ byte_t* arenaEnd(arenaHdr* a)
+{
+    return(((byte_t*)a) + arenaBytes);
+}
+
+void newArena(void)
+{
+    arenaHdr* a;
+    if (arenaSpare != NULL) {
+        a = arenaSpare;
+        arenaSpare = a->next;
+        arenaSpareCount--;
+    }
+    else {
+        a = (arenaHdr*) hostArenaAlloc();
+        assert(a != NULL);
+        a->base = ((byte_t*)a) + spaceRound(sizeof(arenaHdr));
+    }
+    a->top = a->base;
+    a->live = 0;
+    a->next = arenaList;
+    arenaList = a;
+    arenaCur = a;
+}
+
+/*
+Spaces of at least largeLeast address units are "large".  Each gets a
+run of pages of its own from the host, and it's never moved by a
+scavenge or by compaction.  When one is freed, its pages are given back
+to the host at once, so a burst of large objects doesn't leave memory
+behind.  A freed run is kept as a spare if one of the largeSpares slots
+is empty, with its pages discarded but its addresses still reserved,
+because the same sizes are often asked for again (process stacks, for
+instance); runs freed while every slot is full are unmapped, and a slot
+is only emptied by reusing its run.  Hosts without
+mmap get large spaces from the heap like any other space that doesn't
+fit in an arena.
+*/
+#define largeLeast (64 * 1024)
+#define largeSpares 4
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define largePage 4096
+
+addr largeSpare[largeSpares];
+size_t largeSpareLen[largeSpares];
+
+__INLINE__ size_t largeRound(word_t bytes)
+{
+    return(((size_t)bytes + (largePage - 1)) & ~(size_t)(largePage - 1));
+}
+
+addr newLargeSpace(word_t bytes)
+{
+    size_t len = largeRound(bytes);
+    addr ans;
+    word_t i;
+    for (i = 0; i != largeSpares; i++)
+        if (largeSpare[i] != NULL && largeSpareLen[i] == len) {
+            ans = largeSpare[i];
+            largeSpare[i] = NULL;
+#ifndef __linux__
+            /* only Linux guarantees discarded pages come back zeroed */
+            (void)memset(ans, 0, len);
+#endif
+            return(ans);
+        }
+    ans = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    assert(ans != MAP_FAILED);
+    return(ans);
+}
+
+void freeLargeSpace(addr x, word_t bytes)
+{
+    size_t len = largeRound(bytes);
+    word_t i;
+    for (i = 0; i != largeSpares; i++)
+        if (largeSpare[i] == NULL) {
+            (void)madvise(x, len, MADV_DONTNEED);
+            largeSpare[i] = x;
+            largeSpareLen[i] = len;
+            return;
+        }
+    (void)munmap(x, len);
+}
+#else
+#define newLargeSpace(bytes) calloc((bytes), sizeof(byte_t))
+#define freeLargeSpace(x, bytes) free(x)
+#endif
+
+/*
+Returns a zeroed von Neumann space of at least the given number of
+address units, or NULL if none are needed.
+*/
+addr newSpace(word_t bytes)
+{
+    addr ans;
+    word_t len;
+    if (bytes == 0)
+        return(NULL);
+    len = spaceRound(bytes);
+    heapBytes += len;
+    if (len >= largeLeast) {
+        ans = newLargeSpace(len);
+        assert(ans != NULL);
+        return(ans);
+    }
+    if (len > arenaLargest) {
+        ans = calloc(len, sizeof(byte_t));
+        assert(ans != NULL);
+        return(ans);
+    }
+    if ((ans = spaceFree[len / spcGrain]) != NULL)
+        spaceFree[len / spcGrain] = *(addr*)ans;
+    else {
+        if (arenaCur == NULL || arenaCur->top + len > arenaEnd(arenaCur))
+            newArena();
+        ans = arenaCur->top;
+        arenaCur->top += len;
+    }
+    arenaOf(ans)->live += len;
+    (void)memset(ans, 0, len);
+    return(ans);
+}
+
+/*
+Gives back a von Neumann space obtained from newSpace.  The number of
+address units must be the same as was asked for.
+*/
+void freeSpace(addr x, word_t bytes)
+{
+    word_t len;
+    if (x == NULL || inNursery(x))
+        return;
+    len = spaceRound(bytes);
+    heapBytes -= len;
+    if (len >= largeLeast) {
+        freeLargeSpace(x, len);
+        return;
+    }
+    if (len > arenaLargest) {
+        free(x);
+        return;
+    }
+    *(addr*)x = spaceFree[len / spcGrain];
+    spaceFree[len / spcGrain] = x;
+    arenaOf(x)->live -= len;
+}
+
+/*
+Gives back every arena which no longer holds a live object.  Free list
+entries within such arenas are dropped first.  The current arena is
+simply rewound, and a few released arenas are kept as spares so that
+allocation bursts don't bounce arenas back and forth with the host.
+*/
+void releaseArenas(void)
+{
+    arenaHdr** ap;
+    arenaHdr* a;
+    bool any = false;
+    word_t cls;
+    for (a = arenaList; a != NULL; a = a->next)
+        if (a->live == 0) {
+            a->live = -1;
+            any = true;
+        }
+    if (!any)
+        return;
+    for (cls = 0; cls != arenaClasses; cls++) {
+        addr* fp = &spaceFree[cls];
+        while (*fp != NULL)
+            if (arenaOf(*fp)->live < 0)
+                *fp = *(addr*)*fp;
+            else
+                fp = (addr*)*fp;
+    }
+    for (ap = &arenaList; (a = *ap) != NULL;) {
+        if (a->live >= 0) {
+            ap = &a->next;
+            continue;
+        }
+        if (a == arenaCur) {
+            a->top = a->base;
+            a->live = 0;
+            ap = &a->next;
+            continue;
+        }
+        *ap = a->next;
+        if (arenaSpareCount < arenaSpares) {
+            a->next = arenaSpare;
+            arenaSpare = a;
+            arenaSpareCount++;
+        }
+        else
+            hostArenaFree(a);
+    }
+}
+
+bool compactWanted = false;
+void noteFragmentation(void);
+void noteSwept(long entries, long bytes);
+
 __INLINE__ objRef encPtr_to_objRef(encPtr p) {
     objRef result;
     result.ptr = p;
     return result;
 }
 
-void visit(objRef x)
+/*
+Marking is done without recursion, so that long chains of links can't
+exhaust the host stack.  An object is marked when it's first reached and
+then pushed on the mark stack; its class and fields are visited when
+it's popped.  While one object is being scanned we ask the host to
+fetch the object table entry and body of the one below it, which is
+likely to be the next one scanned.
+*/
+#if defined(__GNUC__) || defined(__clang__)
+#define prefetch(a) __builtin_prefetch(a)
+#else
+#define prefetch(a) ((void)0)
+#endif
+
+__INLINE__ void visit(objRef x)
+{
+    if (isIndex(x) && !isMarked(x.ptr)) {
+        isMarkedPut(x.ptr, true);
+        markCount++;
+        ptrListPush(&markStack, x.ptr);
+        prefetch(&objTbl[oteIndexOf(x.ptr)]);
+    }
+}
+
+__INLINE__ void visitFields(encPtr x)
+{
+    objRef* f = (objRef*) addressOf(x);
+    objRef* p = (objRef*) (((byte_t*)f) + spaceOf(x));
+    while (p != f)
+        visit(*--p);
+}
+
+/*
+The fields of a WeakArray don't keep the objects they refer to, and the
+value of an Ephemeron is kept only for as long as its key is reachable
+some other way.  Marking traces only the class of such an object and
+puts the object on a list, to be finished (see finishWeak) once all that
+is otherwise reachable has been marked.  The two classes are known by
+their object table indices, which are zero until they're found.
+*/
+word_t weakArrayIndex = 0;
+word_t ephemeronIndex = 0;
+ptrList weakList = { NULL,0,0 };
+ptrList ephemeronList = { NULL,0,0 };
+
+__INLINE__ bool isWeakOf(encPtr x, word_t cls)
+{
+    return(cls != 0 && oteIndexOf(classOf(x)) == cls && spaceOf(x) != 0);
+}
+
+/* young objects are swept by scavenges, so they aren't dying yet */
+__INLINE__ bool isDying(objRef x)
+{
+    return(isIndex(x) && !isMarked(x.ptr) && !isYoung(x.ptr));
+}
+
+/*
+Puts a weak object aside.  An Ephemeron whose key is already marked is
+traced like any other object.
+Returns true if the fields of the object aren't to be traced now.
+*/
+__INLINE__ bool deferWeak(encPtr x)
+{
+    if (isWeakOf(x, weakArrayIndex)) {
+        ptrListPush(&weakList, x);
+        return(true);
+    }
+    if (isWeakOf(x, ephemeronIndex) && isDying(orefOf(x, 1))) {
+        ptrListPush(&ephemeronList, x);
+        return(true);
+    }
+    return(false);
+}
+
+void finishWeak(void);
+
+/*
+Traces at most the given number of objects from the mark stack (all of
+them if the count is zero).  Entries may have been freed by a scavenge
+since they were pushed, so those are skipped.
+Returns true if the mark stack has been emptied.
+*/
+bool visitMarked(word_t count)
+{
+    word_t done = 0;
+    encPtr x;
+    while (markStack.top) {
+        if (count && done++ == count)
+            return(false);
+        x = markStack.ptrs[--markStack.top];
+        if (isAvail(x))
+            continue;
+        if (markStack.top) {
+            encPtr y = markStack.ptrs[markStack.top - 1];
+            prefetch(&objTbl[oteIndexOf(y)]);
+            prefetch(addressOf(y));
+        }
+        visit(encPtr_to_objRef(classOf(x)));
+        if (isObjRefs(x) && !deferWeak(x))
+            visitFields(x);
+    }
+    return(true);
+}
+
+/*
+Sweeps the entries from hi down to lo.  Marks are cleared from the
+entries which are kept, and the rest are chained together (lowest index
+first) to be put on the free list.  Spaces of unmarked objects are freed
+directly or, if a batch is given, collected in it.
+*/
+typedef struct {
+    encPtr head;
+    encPtr tail;
+    word_t avail;
+    word_t freed;
+    long   bytes;
+} freeChain;
+
+#define spaceBatchDom 256
+
+typedef struct {
+    addr   spcs[spaceBatchDom];
+    word_t lens[spaceBatchDom];
+    word_t top;
+} spaceBatch;
+
+void flushSpaces(spaceBatch* b);
+
+void sweepRange(word_t lo, word_t hi, freeChain* c, spaceBatch* b)
+{
+    word_t ord;
+    encPtr ptr;
+    c->head = c->tail = encIndexOf(0);
+    c->avail = c->freed = 0;
+    c->bytes = 0;
+    for (ord = hi; ord >= lo; ord--) {
+        ptr = encIndexOf(ord);
+        if (!isAvail(ptr)) {
+            if (isMarked(ptr)) {
+                isMarkedPut(ptr, false);
+                continue;
+            }
+            c->freed++;
+            c->bytes += spaceOf(ptr);
+            if (spaceOf(ptr)) {
+                if (b == NULL)
+                    freeSpace(addressOf(ptr), spaceOf(ptr));
+                else {
+                    if (b->top == spaceBatchDom)
+                        flushSpaces(b);
+                    b->spcs[b->top] = addressOf(ptr);
+                    b->lens[b->top++] = spaceOf(ptr);
+                }
+                addressOfPut(ptr, 0);
+                spaceOfPut(ptr, 0);
+            }
+        }
+        clearPointer(ptr);
+        nextFreePut(ptr, c->head);
+        if (oteIndexOf(c->head) == 0)
+            c->tail = ptr;
+        c->head = ptr;
+        c->avail++;
+    }
+}
+
+/*
+On hosts with several cores, the marking and sweeping that reclaim does
+all at once can be shared by helper threads.  Each thread has its own
+mark stack and takes half of another's when its own runs out ("work
+stealing").  Entries are marked with an atomic exchange, so that each
+object is traced by only one thread.  The object table is swept in one
+range per thread, each range making its own chain of free entries, and
+the chains are joined in order afterward.  Spaces are freed in batches
+under a lock, since their free lists and arenas are shared.
+*/
+word_t gcThreads = 1;
+
+#ifndef L2_SMALLTALK_NO_THREADS
+#define gcThreadsMax 64
+#define markBatchDom 256
+
+#ifdef _MSC_VER
+#define markSeen(p, b) ((*(volatile long*)(p) & (b)) != 0)
+#define markOnce(p, b) ((_InterlockedOr((volatile long*)(p), (long)(b)) & (b)) == 0)
+#else
+#define markSeen(p, b) ((__atomic_load_n((p), __ATOMIC_RELAXED) & (b)) != 0)
+#define markOnce(p, b) ((__atomic_fetch_or((p), (b), __ATOMIC_RELAXED) & (b)) == 0)
+#endif
+
+/* size mirrors stack.top so that others can look without locking */
+typedef struct {
+    ptrList    stack;
+    std::mutex lock;
+    std::atomic<word_t> size;
+} markWorker;
+
+markWorker markWorkers[gcThreadsMax];
+std::atomic<int> markBusy;
+std::mutex spaceLock;
+std::mutex weakLock;
+
+void flushSpaces(spaceBatch* b)
+{
+    word_t i;
+    std::lock_guard<std::mutex> hold(spaceLock);
+    for (i = 0; i != b->top; i++)
+        freeSpace(b->spcs[i], b->lens[i]);
+    b->top = 0;
+}
+
+__INLINE__ void visitShared(ptrList* l, objRef x)
 {
-    //printf("Visiting %i\n", x.ptr.dat);
+    uint32_t* m;
+    uint32_t b;
     if (isIndex(x)) {
-        if (!isMarked(x.ptr)) {
-            /* then it's the first time we've visited it, so: */
-            isMarkedPut(x.ptr, true);
-            visit(encPtr_to_objRef(classOf(x.ptr)));
-            if (isObjRefs(x.ptr)) {
-                objRef* f = (objRef*) addressOf(x.ptr);
-                objRef* p = (objRef*) ((byte_t*)f) + spaceOf(x.ptr);
+        m = &markBits[oteIndexOf(x.ptr) >> 5];
+        b = (uint32_t)1 << (oteIndexOf(x.ptr) & 31);
+        if (!markSeen(m, b) && markOnce(m, b))
+            ptrListPush(l, x.ptr);
+    }
+}
+
+/*
+Moves up to the given number of entries from the top of a worker's mark
+stack to the given list.
+Returns the number moved.
+*/
+word_t markTake(markWorker* w, ptrList* l, word_t n)
+{
+    std::lock_guard<std::mutex> hold(w->lock);
+    if (n > w->stack.top)
+        n = w->stack.top;
+    if (n == 0)
+        return(0);
+    while (l->max < l->top + n)
+        ptrListGrow(l);
+    w->stack.top -= n;
+    w->size = w->stack.top;
+    (void)memcpy(&l->ptrs[l->top], &w->stack.ptrs[w->stack.top], (size_t)n * sizeof(encPtr));
+    l->top += n;
+    return(n);
+}
+
+bool markSteal(word_t self, ptrList* l)
+{
+    word_t i;
+    markWorker* v;
+    for (i = 1; i < gcThreads; i++) {
+        v = &markWorkers[(self + i) % gcThreads];
+        if (v->size != 0 && markTake(v, l, (v->size + 1) / 2) != 0)
+            return(true);
+    }
+    return(false);
+}
+
+bool markIdle(void)
+{
+    word_t i;
+    for (i = 0; i < gcThreads; i++)
+        if (markWorkers[i].size != 0)
+            return(false);
+    return(true);
+}
+
+void markWorkerRun(word_t self)
+{
+    markWorker* w = &markWorkers[self];
+    ptrList batch = { NULL,0,0 };
+    ptrList found = { NULL,0,0 };
+    encPtr x;
+    for (;;) {
+        if (markTake(w, &batch, markBatchDom) == 0 && !markSteal(self, &batch)) {
+            markBusy--;
+            for (;;) {
+                if (markBusy == 0)
+                    goto done;
+                if (!markIdle()) {
+                    markBusy++;
+                    if (markSteal(self, &batch))
+                        break;
+                    markBusy--;
+                }
+                std::this_thread::yield();
+            }
+        }
+        while (batch.top) {
+            x = batch.ptrs[--batch.top];
+            if (isAvail(x))
+                continue;
+            visitShared(&found, encPtr_to_objRef(classOf(x)));
+            /* weak objects are all put aside, Ephemerons too */
+            if (isObjRefs(x) && (isWeakOf(x, weakArrayIndex) || isWeakOf(x, ephemeronIndex))) {
+                std::lock_guard<std::mutex> hold(weakLock);
+                ptrListPush(isWeakOf(x, weakArrayIndex) ? &weakList : &ephemeronList, x);
+            }
+            else if (isObjRefs(x)) {
+                objRef* f = (objRef*) addressOf(x);
+                objRef* p = (objRef*) (((byte_t*)f) + spaceOf(x));
                 while (p != f)
-                    visit(*--p);
+                    visitShared(&found, *--p);
             }
         }
+        if (found.top) {
+            std::lock_guard<std::mutex> hold(w->lock);
+            while (w->stack.max < w->stack.top + found.top)
+                ptrListGrow(&w->stack);
+            (void)memcpy(&w->stack.ptrs[w->stack.top], found.ptrs, (size_t)found.top * sizeof(encPtr));
+            w->stack.top += found.top;
+            w->size = w->stack.top;
+            found.top = 0;
+        }
+    }
+done:
+    free(batch.ptrs);
+    free(found.ptrs);
+}
+
+void sweepWorkerRun(word_t lo, word_t hi, freeChain* c)
+{
+    spaceBatch* b = (spaceBatch*) malloc(sizeof(spaceBatch));
+    assert(b != NULL);
+    b->top = 0;
+    sweepRange(lo, hi, c, b);
+    flushSpaces(b);
+    free(b);
+}
+
+/*
+Finishes reclaim using gcThreads threads, the calling one included.
+Returns the number of object table entries left available.
+*/
+word_t reclaimParallel(void)
+{
+    std::thread helpers[gcThreadsMax];
+    freeChain chains[gcThreadsMax];
+    word_t n = gcThreads;
+    word_t i, lo, hi, step;
+    encPtr tail;
+    word_t avail = 0;
+    long freed = 0;
+    long bytes = 0;
+    /* the calling thread starts with everything marked so far */
+    ptrList t = markWorkers[0].stack;
+    markWorkers[0].stack = markStack;
+    markWorkers[0].size = markStack.top;
+    markStack = t;
+    markBusy = (int)n;
+    for (i = 1; i < n; i++)
+        helpers[i] = std::thread(markWorkerRun, i);
+    markWorkerRun(0);
+    for (i = 1; i < n; i++)
+        helpers[i].join();
+    finishWeak();
+    marking = false;
+    /* ranges mustn't share words of the mark bitmap */
+    step = (((otbHib - otbLob + n) / n) + 31) & ~31;
+    for (i = n; i-- > 0; ) {
+        lo = otbLob + i * step;
+        hi = lo + step - 1;
+        if (lo == otbLob)
+            lo++;
+        if (hi > otbHib)
+            hi = otbHib;
+        if (i == 0)
+            sweepWorkerRun(lo, hi, &chains[i]);
+        else
+            helpers[i] = std::thread(sweepWorkerRun, lo, hi, &chains[i]);
+    }
+    for (i = 1; i < n; i++)
+        helpers[i].join();
+    tail = pointerList;
+    for (i = 0; i < n; i++) {
+        if (oteIndexOf(chains[i].head) == 0)
+            continue;
+        nextFreePut(tail, chains[i].head);
+        tail = chains[i].tail;
+        avail += chains[i].avail;
     }
+    for (i = 0; i < n; i++) {
+        freed += chains[i].freed;
+        bytes += chains[i].bytes;
+    }
+    nextFreePut(tail, encIndexOf(0));
+    pointersAvail = avail;
+    releaseArenas();
+    noteFragmentation();
+    noteSwept(freed, bytes);
+    return(avail);
+}
+#else
+void flushSpaces(spaceBatch* b)
+{
+    b->top = 0;
+}
+
+word_t reclaim(bool all);
+
+word_t reclaimParallel(void)
+{
+    gcThreads = 1;
+    return(reclaim(false));
 }
+#endif
 
 extern encPtr symbols;
+extern encPtr nilObj;
+extern bool parsing;
+
+void traceHostRoots(void (*ref)(objRef));
+void traceExecRoots(void (*ref)(objRef), void (*fields)(encPtr));
+
+/*
+Greys an object even if it's already black, so that its fields get
+traced again.  That's needed for objects the interpreter stores into
+directly.
+*/
+void revisit(encPtr x)
+{
+    if (!parsing && ptrEq(encPtr_to_objRef(x), orefOf(symbols, 1)))
+        return;
+    if (!isMarked(x)) {
+        isMarkedPut(x, true);
+        markCount++;
+    }
+    ptrListPush(&markStack, x);
+}
 
 /*
-It's safe to ignore volatile objects only when all necessary object
-references are stored in object memory.  Currently, that's the case
-only upon a successful return from the interpreter.  In operation, the
-interpreter does many stores directly into host memory (as opposed to
-indirectly via the object table).  As a result, volatile objects will
-remain flagged as such.  Tracing them ensures that they (and their
-referents) get kept.
+Remembered objects which have already been marked are traced again,
+since they may have been stored into after their fields were traced.
 */
-void reclaim(bool all)
+void revisitRemembered(void)
 {
     word_t ord;
     encPtr ptr;
-    visit(encPtr_to_objRef(symbols));
-    if (all)
-        for (ord = otbLob; ord <= otbHib; ord++) {
-            ptr = encIndexOf(ord);
-            if (isVolatile(ptr))
-                visit(encPtr_to_objRef(ptr));
+    for (ord = 0; ord != rememberedSet.top; ord++) {
+        ptr = rememberedSet.ptrs[ord];
+        if (isRemembered(ptr) && isMarked(ptr))
+            revisit(ptr);
+    }
+}
+
+/*
+Entries of the symbol table whose value is nil (symbols which aren't the
+names of globals) don't keep their symbols.  The table and its links are
+marked without being traced, and the keys and values of the other
+entries are traced.  The compiler holds symbols it got from the table in
+host variables while it works, so while it's parsing every entry is
+traced.
+*/
+bool parsing = false;
+
+__INLINE__ void markEntry(encPtr x)
+{
+    if (parsing)
+        revisit(x);
+    else if (!isMarked(x)) {
+        isMarkedPut(x, true);
+        markCount++;
+    }
+    visit(encPtr_to_objRef(classOf(x)));
+}
+
+void traceSymbols(void)
+{
+    encPtr table, link;
+    word_t i;
+    markEntry(symbols);
+    for (i = 2; i <= countOf(symbols); i++)
+        visit(orefOf(symbols, i));
+    table = orefOf(symbols, 1).ptr;
+    markEntry(table);
+    for (i = 1; i + 2 <= countOf(table); i += 3) {
+        if (ptrNe(orefOf(table, i + 1), encPtr_to_objRef(nilObj))) {
+            visit(orefOf(table, i));
+            visit(orefOf(table, i + 1));
         }
-    classOfPut(pointerList, encIndexOf(0));
-    for (ord = otbHib; ord > otbLob; ord--) {	/*fix*/
-        ptr = encIndexOf(ord);
-        if (isAvail(ptr)) {
-            freePointer(ptr);
-            continue;
+        for (link = orefOf(table, i + 2).ptr; ptrNe(encPtr_to_objRef(link), encPtr_to_objRef(nilObj)); link = orefOf(link, 3).ptr) {
+            markEntry(link);
+            if (ptrNe(orefOf(link, 2), encPtr_to_objRef(nilObj))) {
+                visit(orefOf(link, 1));
+                visit(orefOf(link, 2));
+            }
+        }
+    }
+}
+
+/*
+Drops the entries of the symbol table whose symbols are about to be
+swept.  Links which are dropped lose their keys too, since they survive
+until the next collection.
+*/
+void pruneSymbols(void)
+{
+    encPtr table = orefOf(symbols, 1).ptr;
+    encPtr link, next, prev;
+    word_t i;
+    for (i = 1; i + 2 <= countOf(table); i += 3) {
+        if (isDying(orefOf(table, i)))
+            orefOfPut(table, i, encPtr_to_objRef(nilObj));
+        prev = nilObj;
+        for (link = orefOf(table, i + 2).ptr; ptrNe(encPtr_to_objRef(link), encPtr_to_objRef(nilObj)); link = next) {
+            next = orefOf(link, 3).ptr;
+            if (!isDying(orefOf(link, 1))) {
+                prev = link;
+                continue;
+            }
+            orefOfPut(link, 1, encPtr_to_objRef(nilObj));
+            if (ptrEq(encPtr_to_objRef(prev), encPtr_to_objRef(nilObj)))
+                orefOfPut(table, i + 2, encPtr_to_objRef(next));
+            else
+                orefOfPut(prev, 3, encPtr_to_objRef(next));
+        }
+    }
+}
+
+__INLINE__ void clearDying(encPtr x, bool all)
+{
+    objRef* f = (objRef*) addressOf(x);
+    objRef* p = (objRef*) (((byte_t*)f) + spaceOf(x));
+    while (p != f) {
+        p--;
+        if (all || isDying(*p))
+            *p = encPtr_to_objRef(nilObj);
+    }
+}
+
+/*
+Objects registered for finalization are held by finalList without being
+kept alive by it.  When finishWeak finds one of them about to be swept,
+it's moved to finalQueue, which is a root, so that it and whatever it
+refers to survive until a Smalltalk process (see
+Smalltalk>>finalizationLoop:) has sent it finalize.  Scavenges treat
+finalList as roots, so that registered objects are only ever found dead
+by marking.  An object is flagged (see isFinal) while it's in finalList,
+so that registering it again needn't search the list.
+*/
+ptrList finalList = { NULL,0,0 };
+ptrList finalQueue = { NULL,0,0 };
+encPtr finalSem = encIndexLit(1);
+bool finalWanted = false;
+
+/*
+Queues the registered objects which are about to be swept and marks
+them again.
+Returns true if any were queued.
+*/
+bool queueFinalizers(void)
+{
+    word_t i, j;
+    encPtr x;
+    bool found = false;
+    for (i = j = 0; i != finalList.top; i++) {
+        x = finalList.ptrs[i];
+        if (isDying(encPtr_to_objRef(x))) {
+            isFinalPut(x, false);
+            ptrListPush(&finalQueue, x);
+            visit(encPtr_to_objRef(x));
+            found = true;
+        }
+        else
+            finalList.ptrs[j++] = x;
+    }
+    finalList.top = j;
+    if (found)
+        finalWanted = true;
+    return(found);
+}
+
+/*
+Finishes marking.  Ephemerons whose keys have become reachable have
+their fields traced, which may make the keys of others reachable, until
+no more are found.  Objects registered for finalization which are still
+unmarked are then queued (see queueFinalizers), and since that marks
+them and what they refer to, the Ephemerons are looked at again.  Then
+the symbol table, the remaining Ephemerons and
+the WeakArrays are cleared of whatever is about to be swept.  Entries of
+the lists may have been freed or reused by a scavenge since they were
+put there; those which are no longer marked weak objects are skipped.
+*/
+void finishWeak(void)
+{
+    word_t i, j;
+    bool more;
+    encPtr x;
+    do {
+        more = false;
+        for (i = j = 0; i != ephemeronList.top; i++) {
+            x = ephemeronList.ptrs[i];
+            if (isAvail(x) || !isMarked(x) || !isWeakOf(x, ephemeronIndex))
+                continue;
+            if (isDying(orefOf(x, 1)))
+                ephemeronList.ptrs[j++] = x;
+            else {
+                visitFields(x);
+                more = true;
+            }
         }
+        ephemeronList.top = j;
+        if (!more)
+            more = queueFinalizers();
+        (void)visitMarked(0);
+    } while (more);
+    if (!parsing)
+        pruneSymbols();
+    for (i = 0; i != ephemeronList.top; i++)
+        clearDying(ephemeronList.ptrs[i], true);
+    for (i = 0; i != weakList.top; i++) {
+        x = weakList.ptrs[i];
+        if (!isAvail(x) && isMarked(x) && isWeakOf(x, weakArrayIndex))
+            clearDying(x, false);
+    }
+    ephemeronList.top = 0;
+    weakList.top = 0;
+}
+
+void findWeakClasses(void);
+
+extern ptrList youngList;
+
+/*
+We keep statistics of memory management for the image to look at (see
+primGCStatistics) and, if gcLog is set, write a line about each pause
+and each finished sweep to stderr.  A pause is a scavenge, an increment
+of marking, a full collection (finishing marking and, with helper
+threads, sweeping) or a compaction; when one happens inside another,
+the pause counts as the later kind in that order.  Pause times are in
+microseconds.  The histogram has a bucket for pauses under 16us, one
+for each factor of four up to 64ms, and one for the rest.
+*/
+#define gcScavenge 0
+#define gcIncrement 1
+#define gcCollection 2
+#define gcCompaction 3
+#define gcKindDom 4
+#define gcHistDom 8
+
+const char* gcKindNames[gcKindDom] = { "scavenge", "mark", "collect", "compact" };
+long gcCount[gcKindDom];
+long gcPauseSum = 0;
+long gcPauseMax = 0;
+long gcPauseHist[gcHistDom];
+long gcFreedSum = 0;
+long gcBytesSum = 0;
+long gcFreedLast = 0;
+long gcBytesLast = 0;
+bool gcLog = false;
+int gcDepth = 0;
+word_t gcKind = 0;
+long gcStarted = 0;
+long gcPauseFreed = 0;
+long gcPauseBytes = 0;
+
+long gcMicros(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct timespec t;
+    (void)clock_gettime(CLOCK_MONOTONIC, &t);
+    return((long)t.tv_sec * 1000000 + t.tv_nsec / 1000);
+#else
+    return((long)((double)clock() * 1000000.0 / CLOCKS_PER_SEC));
+#endif
+}
+
+void gcBegin(word_t kind)
+{
+    if (gcDepth++ == 0) {
+        gcStarted = gcMicros();
+        gcKind = kind;
+        gcPauseFreed = gcPauseBytes = 0;
+    }
+    else if (kind > gcKind)
+        gcKind = kind;
+}
+
+void gcEnd(void)
+{
+    long pause;
+    word_t b;
+    if (--gcDepth != 0)
+        return;
+    pause = gcMicros() - gcStarted;
+    gcCount[gcKind]++;
+    gcPauseSum += pause;
+    if (pause > gcPauseMax)
+        gcPauseMax = pause;
+    for (b = 0; b + 1 < gcHistDom && pause >= ((long)16 << (2 * b)); b++)
+        ;
+    gcPauseHist[b]++;
+    if (gcLog)
+        (void)fprintf(stderr, "gc %s %.0fus: freed %.0f entries %.0f bytes, %.0f entries available, %.0f bytes in spaces\n",
+            gcKindNames[gcKind], (double)pause, (double)gcPauseFreed, (double)gcPauseBytes,
+            (double)pointersAvail, (double)heapBytes);
+}
+
+/*
+Counts what a sweep or a scavenge freed.  Lazy sweeps are logged when
+they finish outside a pause.
+*/
+void noteSwept(long entries, long bytes)
+{
+    gcFreedSum += entries;
+    gcBytesSum += bytes;
+    gcFreedLast = entries;
+    gcBytesLast = bytes;
+    gcPauseFreed += entries;
+    gcPauseBytes += bytes;
+    if (gcLog && gcDepth == 0)
+        (void)fprintf(stderr, "gc sweep: freed %.0f entries %.0f bytes\n",
+            (double)entries, (double)bytes);
+}
+
+/*
+Sweeping is done lazily.  Once marking is finished, the entries are
+swept upward from a cursor a little at a time:  by newPointer whenever
+the free list runs dry, at the start of every interpreter time slice,
+and all at once when the host is about to wait for input or when
+marking is about to start again.  Entries at or above the cursor which
+are handed out in the meantime are marked, so that the sweep keeps them.
+Available entries found by the sweep are already on the free list.
+*/
+bool sweeping = false;
+word_t sweepNext = 0;
+word_t sweepBudget = 16384;
+long sweepFreed = 0;
+long sweepBytes = 0;
+
+/*
+Sweeps at most the given number of entries (all that are left if the
+count is zero).
+Returns true if the sweep is finished.
+*/
+bool sweepStep(word_t count)
+{
+    encPtr ptr;
+    word_t lim = otbHib;
+    if (!sweeping)
+        return(true);
+    if (count && count < lim - sweepNext + 1)
+        lim = sweepNext + count - 1;
+    for (; sweepNext <= lim; sweepNext++) {
+        ptr = encIndexOf(sweepNext);
         if (isMarked(ptr)) {
-            if (!all)				/*stored but not by orefOfPut...*/
-                isVolatilePut(ptr, false);
             isMarkedPut(ptr, false);
             continue;
         }
+        if (isAvail(ptr))
+            continue;
+        sweepFreed++;
+        sweepBytes += spaceOf(ptr);
         if (spaceOf(ptr)) {
-            freeStorage(addressOf(ptr));
+            freeSpace(addressOf(ptr), spaceOf(ptr));
             addressOfPut(ptr, 0);
             spaceOfPut(ptr, 0);
         }
         freePointer(ptr);
     }
+    if (sweepNext <= otbHib)
+        return(false);
+    sweeping = false;
+    releaseArenas();
+    noteFragmentation();
+    noteSwept(sweepFreed, sweepBytes);
+    sweepFreed = sweepBytes = 0;
+    return(true);
+}
+
+/*
+Nothing but the object table refers to von Neumann spaces, so spaces
+can be moved by just updating their entries.  Once the spaces given
+back to the arenas add up to more than compactRatio percent of what the
+arenas have handed out, "compaction" is asked for.  It slides every space
+held in an arena towards the lowest addressed arena, in address order,
+so that the arenas left empty can be given back to the host.  Spaces
+only ever move to lower addresses, so they can't overwrite one another.
+Like a scavenge, compaction may only happen at a safe point, and one is
+done first so that only arenas hold spaces worth moving.  A ratio of
+zero means compaction only happens when it's asked for by the image.
+*/
+word_t compactRatio = 50;
+#define compactLeast 4		/* arenas in use before compaction pays */
+
+int compareSpaces(const void* x, const void* y)
+{
+    uintptr_t a = (uintptr_t)addressOf(*(const encPtr*)x);
+    uintptr_t b = (uintptr_t)addressOf(*(const encPtr*)y);
+    return((a > b) - (a < b));
+}
+
+int compareArenas(const void* x, const void* y)
+{
+    uintptr_t a = (uintptr_t)*(arenaHdr* const*)x;
+    uintptr_t b = (uintptr_t)*(arenaHdr* const*)y;
+    return((a > b) - (a < b));
+}
+
+void noteFragmentation(void)
+{
+    arenaHdr* a;
+    size_t used = 0;
+    size_t live = 0;
+    word_t n = 0;
+    for (a = arenaList; a != NULL; a = a->next) {
+        used += a->top - a->base;
+        live += a->live;
+        n++;
+    }
+    if (compactRatio && n >= compactLeast &&
+        (used - live) * 100 > used * (size_t)compactRatio)
+        compactWanted = true;
+}
+
+void compact(void)
+{
+    encPtr* spaces;
+    arenaHdr** arenas;
+    arenaHdr* a;
+    word_t count = 0;
+    word_t n = 0;
+    word_t i;
+    word_t k;
+    encPtr ptr;
+    addr mem;
+    word_t len;
+    gcBegin(gcCompaction);
+    (void)sweepStep(0);
+    compactWanted = false;
+    for (a = arenaList; a != NULL; a = a->next)
+        n++;
+    if (n == 0) {
+        gcEnd();
+        return;
+    }
+    spaces = (encPtr*) malloc((size_t)(otbHib - otbLob) * sizeof(encPtr));
+    arenas = (arenaHdr**) malloc((size_t)n * sizeof(arenaHdr*));
+    assert(spaces != NULL && arenas != NULL);
+    for (i = otbLob + 1; i <= otbHib; i++) {
+        ptr = encIndexOf(i);
+        if (isAvail(ptr) || (mem = addressOf(ptr)) == NULL || inNursery(mem))
+            continue;
+        if (spaceRound(spaceOf(ptr)) <= arenaLargest)
+            spaces[count++] = ptr;
+    }
+    qsort(spaces, count, sizeof(encPtr), compareSpaces);
+    for (i = 0, a = arenaList; a != NULL; a = a->next)
+        arenas[i++] = a;
+    qsort(arenas, n, sizeof(arenaHdr*), compareArenas);
+    for (i = 0; i != n; i++) {
+        arenas[i]->next = (i + 1 == n) ? NULL : arenas[i + 1];
+        arenas[i]->top = arenas[i]->base;
+        arenas[i]->live = 0;
+    }
+    arenaList = arenas[0];
+    (void)memset(spaceFree, 0, sizeof spaceFree);
+    for (i = 0, k = 0; i != count; i++) {
+        ptr = spaces[i];
+        len = spaceRound(spaceOf(ptr));
+        while (arenas[k]->top + len > arenaEnd(arenas[k]))
+            k++;
+        mem = arenas[k]->top;
+        if (mem != addressOf(ptr)) {
+            (void)memmove(mem, addressOf(ptr), len);
+            addressOfPut(ptr, mem);
+        }
+        arenas[k]->top += len;
+        arenas[k]->live += len;
+    }
+    arenaCur = arenas[k];
+    free(spaces);
+    free(arenas);
+    releaseArenas();
+    gcEnd();
+}
+
+/*
+The roots of memory reclamation are the objects the host refers to (see
+traceHostRoots) and, if all is true, the state of every interpreter
+activation and every young object.  Reclamation may be asked for while
+the host is part way through building objects, which are then referred
+to only from host variables.  Such objects were all allocated since the
+last scavenge (scavenges only happen between bytecodes), so they are
+still young.  Young objects are swept by the next scavenge, not here.
+Unless helper threads are used, the sweep is left to be done lazily.
+Returns the number of object table entries which are or will be left
+available.
+*/
+word_t reclaim(bool all)
+{
+    word_t ord;
+    encPtr ptr;
+    gcBegin(gcCollection);
+    (void)sweepStep(0);
+    if (!marking)
+        markCount = 0;
+    findWeakClasses();
+    traceSymbols();
+    traceHostRoots(visit);
+    if (all) {
+        traceExecRoots(visit, revisit);
+        for (ord = 0; ord != youngList.top; ord++) {
+            ptr = youngList.ptrs[ord];
+            if (isYoung(ptr))
+                visit(encPtr_to_objRef(ptr));
+        }
+    }
+    revisitRemembered();
+    allocBytes = 0;
+    if (gcThreads > 1) {
+        ord = reclaimParallel();
+        gcEnd();
+        return(ord);
+    }
+    (void)visitMarked(0);
+    finishWeak();
+    marking = false;
+    sweeping = true;
+    sweepNext = otbLob + 1;
+    gcEnd();
+    return(otbHib - otbLob - markCount);
+}
+
+/*
+Extends the object table so that it covers indices up to and including
+the one given.  The new entries are available but aren't yet on the
+free list.  Existing entries keep their indices, so only the table
+itself moves.
+*/
+void extendObjectTable(word_t hib)
+{
+    word_t dom = (hib + 1) - otbLob;
+    word_t i;
+    assert(hib > otbHib && hib <= otbLimit);
+    objTbl = (otbEnt*) realloc(objTbl, (size_t)dom * sizeof(otbEnt));
+    assert(objTbl != NULL);
+    markBits = (uint32_t*) realloc(markBits, markBitsDom(dom) * sizeof(uint32_t));
+    assert(markBits != NULL);
+    (void)memset(&objTbl[otbDom], 0, (size_t)(dom - otbDom) * sizeof(otbEnt));
+    (void)memset(&markBits[markBitsDom(otbDom)], 0,
+        (markBitsDom(dom) - markBitsDom(otbDom)) * sizeof(uint32_t));
+    for (i = otbHib + 1; i <= hib; i++)
+        isAvailPut(encIndexOf(i), true);
+    otbHib = hib;
+}
+
+/*
+Grows the object table by otbGrowth percent of its size (but at least a
+chunk) and puts the new entries on the free list, lowest index first.
+*/
+word_t otbGrowth = 50;
+
+void growObjectTable(void)
+{
+    word_t old = otbHib;
+    word_t add = (word_t)(((long)otbDom * otbGrowth) / 100);
+    word_t ord;
+    if (add < otbChunk)
+        add = otbChunk;
+    if (add > otbLimit - otbHib)
+        add = otbLimit - otbHib;
+    assert(add > 0);
+    extendObjectTable(otbHib + add);
+    for (ord = otbHib; ord > old; ord--)
+        freePointer(encIndexOf(ord));
+}
+
+/*
+Almost every object the interpreter allocates becomes garbage almost
+immediately.  A "scavenge" recovers such objects without looking at the
+rest of the object table.  Its roots are the objects the host refers
+to, the remembered set and the state of every interpreter activation
+(see traceExecRoots).  Young objects reachable
+from those are promoted:  their spaces are copied out of the nursery
+into an arena and they stop being young.  All other young objects are
+freed and the nursery is emptied.  The work done is proportional to the
+number of objects allocated since the last scavenge plus the size of the
+remembered set, not to the size of the object table.  Because spaces are
+moved, a scavenge may only happen where nothing but the interpreter's
+registers hold host addresses of spaces (see safePoint).
+*/
+ptrList youngList = { NULL,0,0 };
+ptrList scavengeStack = { NULL,0,0 };
+bool scavengeWanted = false;
+
+__INLINE__ void scavengeRef(objRef x)
+{
+    if (isIndex(x) && isYoung(x.ptr) && !isScavenged(x.ptr)) {
+        isScavengedPut(x.ptr, true);
+        ptrListPush(&scavengeStack, x.ptr);
+    }
+}
+
+void scavengeFields(encPtr x)
+{
+    scavengeRef(encPtr_to_objRef(classOf(x)));
+    if (isObjRefs(x)) {
+        objRef* f = (objRef*) addressOf(x);
+        objRef* p = (objRef*) (((byte_t*)f) + spaceOf(x));
+        while (p != f)
+            scavengeRef(*--p);
+    }
+}
+
+
+void scavenge(void)
+{
+    word_t ord;
+    encPtr ptr;
+    addr mem;
+    long freed = 0;
+    long bytes = 0;
+    gcBegin(gcScavenge);
+    traceHostRoots(scavengeRef);
+    for (ord = 0; ord != finalList.top; ord++)
+        scavengeRef(encPtr_to_objRef(finalList.ptrs[ord]));
+    for (ord = 0; ord != rememberedSet.top; ord++) {
+        ptr = rememberedSet.ptrs[ord];
+        if (isRemembered(ptr)) {
+            isRememberedPut(ptr, false);
+            if (marking && isMarked(ptr))
+                revisit(ptr);
+            if (!isYoung(ptr))
+                scavengeFields(ptr);
+        }
+    }
+    rememberedSet.top = 0;
+    traceExecRoots(scavengeRef, scavengeFields);
+    while (scavengeStack.top != 0)
+        scavengeFields(scavengeStack.ptrs[--scavengeStack.top]);
+    for (ord = 0; ord != youngList.top; ord++) {
+        ptr = youngList.ptrs[ord];
+        if (!isYoung(ptr))
+            continue;
+        isYoungPut(ptr, false);
+        if (isScavenged(ptr)) {
+            isScavengedPut(ptr, false);
+            if (inNursery(addressOf(ptr))) {
+                mem = newSpace(spaceOf(ptr));
+                (void)memcpy(mem, addressOf(ptr), spaceOf(ptr));
+                addressOfPut(ptr, mem);
+            }
+            if (marking)
+                shade(ptr);
+            continue;
+        }
+        freed++;
+        bytes += spaceOf(ptr);
+        if (spaceOf(ptr)) {
+            freeSpace(addressOf(ptr), spaceOf(ptr));
+            addressOfPut(ptr, 0);
+            spaceOfPut(ptr, 0);
+        }
+        freePointer(ptr);
+    }
+    youngList.top = 0;
+    (void)memset(nurseryBase, 0, nurseryTop - nurseryBase);
+    nurseryTop = nurseryBase;
+    scavengeWanted = false;
+    noteSwept(freed, bytes);
+    gcEnd();
+}
+
+/*
+Returns a zeroed von Neumann space for a young object, from the nursery
+if it fits.  Once the nursery is full, a scavenge is asked for and space
+comes from the arenas until it happens.
+*/
+addr newYoungSpace(word_t bytes)
+{
+    word_t len;
+    addr ans;
+    if (bytes == 0)
+        return(NULL);
+    if (nurseryBase == NULL) {
+        nurseryBase = (byte_t*) calloc(nurseryBytes, sizeof(byte_t));
+        assert(nurseryBase != NULL);
+        nurseryTop = nurseryBase;
+        nurseryEnd = nurseryBase + nurseryBytes;
+    }
+    len = spaceRound(bytes);
+    if (len <= arenaLargest) {
+        if (nurseryTop + len <= nurseryEnd) {
+            ans = nurseryTop;
+            nurseryTop += len;
+            return(ans);
+        }
+        scavengeWanted = true;
+    }
+    return(newSpace(bytes));
+}
+
+/*
+Rather than reclaim everything at once when the free list runs dry, we
+start marking once it runs low and do a bounded amount of it at a time
+(see markStep).  Marking starts from the objects the host refers to and
+the state of every interpreter activation.  Increments are paced by
+allocation, so that marking should be done before half of the entries
+which were free at the start have been used.  Objects allocated in the
+meantime are left white; they're young, and young objects are roots
+when marking finishes.  When the mark stack runs empty, the roots are
+traced once more (the interpreter pushes onto process stacks without
+the write barrier), remembered objects are traced again and the table is
+swept, all by reclaim.  If the free
+list runs dry first, reclaim does whatever marking is left in one go.
+The number of objects traced per increment is the pause budget; zero
+means that marking isn't done incrementally at all.
+*/
+word_t markBudget = 4096;
+word_t markPace = 0;
+word_t markDebt = 0;
+bool markWanted = false;
+
+void markStart(void)
+{
+    word_t live;
+    (void)sweepStep(0);
+    live = otbDom - pointersAvail;
+    marking = true;
+    markCount = 0;
+    findWeakClasses();
+    traceSymbols();
+    traceHostRoots(visit);
+    traceExecRoots(visit, revisit);
+    markPace = (word_t)(((long)pointersAvail * markBudget) / (2 * (long)live + 1));
+    if (markPace == 0)
+        markPace = 1;
+    markDebt = 0;
+}
+
+void markStep(void)
+{
+    gcBegin(gcIncrement);
+    markWanted = false;
+    markDebt = 0;
+    if (!marking)
+        markStart();
+    else if (visitMarked(markBudget))
+        if (reclaim(true) < otbDom / 4)
+            growObjectTable();
+    gcEnd();
 }
 
 encPtr newPointer(void)
 {
-    encPtr ans = classOf(pointerList);
-    if (oteIndexOf(ans) == 0) {
-        reclaim(true);
-        ans = classOf(pointerList);
+    encPtr ans;
+    while (oteIndexOf(ans = classOf(pointerList)) == 0) {
+        if (sweeping)
+            (void)sweepStep(64);
+        /* grow rather than thrash if reclaiming left little room */
+        else if (reclaim(true) < otbDom / 4)
+            growObjectTable();
     }
-    assert(oteIndexOf(ans) != 0);
-    classOfPut(pointerList, classOf(ans));
+    nextFreePut(pointerList, classOf(ans));
+    pointersAvail--;
 #if 0
     classOfPut(ans, encIndexOf(0));
 #endif
-    isVolatilePut(ans, true);
     isAvailPut(ans, false);
+    if (sweeping && oteIndexOf(ans) >= sweepNext)
+        isMarkedPut(ans, true);
+    isYoungPut(ans, true);
+    ptrListPush(&youngList, ans);
+    if (youngList.top > otbDom / 4)
+        scavengeWanted = true;
+    if (marking && ++markDebt >= markPace)
+        markWanted = true;
+    else if (markBudget && !sweeping && pointersAvail < otbDom / 8)
+        markWanted = true;
     return(ans);
 }
 
+/*
+Besides running low on object table entries, two things can make us
+collect.  Once gcTrigger address units have been asked for since the
+last collection, marking is started.  Once spaces outside the nursery
+hold more than seven eighths of heapLimit address units, everything is
+reclaimed on the spot.  If they still hold that much, the image is told
+that space is low by signalling the Semaphore it registered (see
+primLowSpace).  The last eighth is a reserve for the image to react in;
+if even that gets used up, we give up.  A trigger or limit of zero means
+there isn't one.  Each full reclamation done for the limit puts off the
+next until another sixteenth of it has been allocated, so that a heap
+just under the limit doesn't thrash.
+*/
+size_t gcTrigger = 0;
+size_t heapLimit = 0;
+size_t heapCheckAt = 0;
+extern encPtr nilObj;
+encPtr lowSpaceSem = encIndexLit(1);
+bool lowSpaceWanted = false;
+
+void heapExhausted(void)
+{
+    size_t low = heapLimit - heapLimit / 8;
+    (void)reclaim(true);
+    (void)sweepStep(0);
+    scavengeWanted = true;
+    if (heapBytes > low && ptrNe(encPtr_to_objRef(lowSpaceSem), encPtr_to_objRef(nilObj)))
+        lowSpaceWanted = true;
+    if (heapBytes > heapLimit) {
+        (void)fprintf(stderr, "heap limit exceeded\n");
+        exit(1);
+    }
+    heapCheckAt = (heapBytes > low ? heapBytes : low) + heapLimit / 16;
+}
+
+__INLINE__ void heapCheck(word_t bytes)
+{
+    allocBytes += bytes;
+    if (heapLimit && heapBytes > (heapCheckAt ? heapCheckAt : heapLimit - heapLimit / 8))
+        heapExhausted();
+    else if (gcTrigger && allocBytes >= gcTrigger && !marking && !sweeping)
+        markWanted = true;
+}
+
 addr newStorage(word_t bytes)
 {
     addr ans;
@@ -473,12 +2065,13 @@ void coldObjectTable(void)
     word_t i;
     objTbl = (otbEnt*) calloc(otbDom, sizeof(otbEnt));
     assert(objTbl != NULL);
-    ob2Tbl = (ot2Ent*) calloc(otbDom, sizeof(ot2Ent));
-    assert(ob2Tbl != NULL);
+    markBits = (uint32_t*) calloc(markBitsDom(otbDom), sizeof(uint32_t));
+    assert(markBits != NULL);
     for (i = otbLob; i != otbHib; i++) {
-        classOfPut(encIndexOf(i), encIndexOf(i + 1));
+        nextFreePut(encIndexOf(i), encIndexOf(i + 1));
         isAvailPut(encIndexOf(i + 1), true);
     }
+    pointersAvail = otbHib - otbLob;
 }
 
 void warmObjectTableOne(void)
@@ -486,8 +2079,8 @@ void warmObjectTableOne(void)
     word_t i;
     objTbl = (otbEnt*) calloc(otbDom, sizeof(otbEnt));
     assert(objTbl != NULL);
-    ob2Tbl = (ot2Ent*) calloc(otbDom, sizeof(ot2Ent));
-    assert(ob2Tbl != NULL);
+    markBits = (uint32_t*) calloc(markBitsDom(otbDom), sizeof(uint32_t));
+    assert(markBits != NULL);
     for (i = otbLob; i != otbHib; i++)
         isAvailPut(encIndexOf(i + 1), true);
 }
@@ -495,7 +2088,8 @@ void warmObjectTableOne(void)
 void warmObjectTableTwo(void)
 {
     word_t i;
-    classOfPut(pointerList, encIndexOf(0));
+    nextFreePut(pointerList, encIndexOf(0));
+    pointersAvail = 0;
     for (i = otbHib; i > otbLob; i--)	/*fix*/
         if (isAvail(encIndexOf(i)))
             freePointer(encIndexOf(i));
@@ -505,11 +2099,13 @@ extern encPtr nilObj;
 
 encPtr allocOrefObj(word_t n)
 {
-    encPtr ptr = newPointer();
-    word_t   num = n << 3;// 2;			/*fix*/
-    addr   mem = newStorage(num);
+    encPtr ptr;
+    heapCheck(n << orefScale);
+    ptr = newPointer();
+    word_t   num = n << orefScale;
+    addr   mem = newYoungSpace(num);
     addressOfPut(ptr, mem);
-    scaleOfPut(ptr, 3);			/*fix*/
+    scaleOfPut(ptr, orefScale);
     isObjRefsPut(ptr, true);
     spaceOfPut(ptr, num);
     classOfPut(ptr, nilObj);
@@ -524,9 +2120,11 @@ encPtr allocOrefObj(word_t n)
 
 encPtr allocByteObj(word_t n)
 {
-    encPtr ptr = newPointer();
+    encPtr ptr;
+    heapCheck(n << 0);
+    ptr = newPointer();
     word_t   num = n << 0;			/*fix*/
-    addr   mem = newStorage(num);
+    addr   mem = newYoungSpace(num);
     addressOfPut(ptr, mem);
     scaleOfPut(ptr, 0);			/*fix*/
     isObjRefsPut(ptr, false);
@@ -537,9 +2135,11 @@ encPtr allocByteObj(word_t n)
 
 encPtr allocHWrdObj(word_t n)
 {
-    encPtr ptr = newPointer();
+    encPtr ptr;
+    heapCheck(n << 1);
+    ptr = newPointer();
     word_t   num = n << 1;			/*fix*/
-    addr   mem = newStorage(num);
+    addr   mem = newYoungSpace(num);
     addressOfPut(ptr, mem);
     scaleOfPut(ptr, 1);			/*fix*/
     isObjRefsPut(ptr, false);
@@ -550,9 +2150,11 @@ encPtr allocHWrdObj(word_t n)
 
 encPtr allocWordObj(word_t n)
 {
-    encPtr ptr = newPointer();
+    encPtr ptr;
+    heapCheck(n << 2);
+    ptr = newPointer();
     word_t   num = n << 2;			/*fix*/
-    addr   mem = newStorage(num);
+    addr   mem = newYoungSpace(num);
     addressOfPut(ptr, mem);
     scaleOfPut(ptr, 2);			/*fix*/
     isObjRefsPut(ptr, false);
@@ -565,7 +2167,7 @@ encPtr allocZStrObj(const char* zstr)
 {
     encPtr ptr = newPointer();
     word_t   num = strlen(zstr) + 1;
-    addr   mem = newStorage(num);
+    addr   mem = newYoungSpace(num);
     addressOfPut(ptr, mem);
     scaleOfPut(ptr, 0);			/*fix*/
     isObjRefsPut(ptr, false);
@@ -582,7 +2184,7 @@ encPtr allocZStrObj(const char* zstr)
 #define superClassInClass 4
 #define variablesInClass 5
 
-#define methodSize 8
+#define methodSize 10
 #define textInMethod 1
 #define messageInMethod 2
 #define bytecodesInMethod 3
@@ -591,6 +2193,8 @@ encPtr allocZStrObj(const char* zstr)
 #define temporarySizeInMethod 6
 #define methodClassInMethod 7
 #define watchInMethod 8
+#define decodedInMethod 9
+#define cachesInMethod 10
 
 #define methodStackSize(x) intValueOf(orefOf(x, stackSizeInMethod).val)
 #define methodTempSize(x) intValueOf(orefOf(x, temporarySizeInMethod).val)
@@ -612,16 +2216,16 @@ encPtr allocZStrObj(const char* zstr)
 #define stackTopInProcess 2
 #define linkPtrInProcess 3
 
-encPtr nilObj = { false,1 };	/* pseudo variable nil */
+encPtr nilObj = encIndexLit(1);	/* pseudo variable nil */
 
-encPtr trueObj = { false,2 };	/* pseudo variable true */
-encPtr falseObj = { false,3 };	/* pseudo variable false */
+encPtr trueObj = encIndexLit(2);	/* pseudo variable true */
+encPtr falseObj = encIndexLit(3);	/* pseudo variable false */
 
 #if 0
-encPtr hashTable = { false,4 };
+encPtr hashTable = encIndexLit(4);
 #endif
-encPtr symbols = { false,5 };
-encPtr classes = { false,1 };
+encPtr symbols = encIndexLit(5);
+encPtr classes = encIndexLit(1);
 
 encPtr unSyms[16];// = {};
 encPtr binSyms[32];// = {};
@@ -662,8 +2266,6 @@ void nameTableInsert(encPtr dict, word_t hash, encPtr key, encPtr value)
             else
                 while (1)
                     if (ptrEq(orefOf(link, 1), encPtr_to_objRef(key))) {
-                        /* get rid of unwanted Link */
-                        isVolatilePut(nwLink, false);
                         orefOfPut(link, 2, encPtr_to_objRef(value));
                         break;
                     }
@@ -732,7 +2334,7 @@ word_t symHash(encPtr sym)
 }
 
 const char* charBuffer = 0;
-encPtr objBuffer = { true,0 };
+encPtr objBuffer = encValueLit(0);
 
 int strTest(encPtr key)
 {
@@ -773,6 +2375,15 @@ const char* binStrs[] = {
 
 encPtr newSymbol(const char* str);
 
+void findWeakClasses(void)
+{
+    encPtr cls;
+    if (weakArrayIndex == 0 && ptrNe(encPtr_to_objRef(cls = globalValue("WeakArray")), encPtr_to_objRef(nilObj)))
+        weakArrayIndex = oteIndexOf(cls);
+    if (ephemeronIndex == 0 && ptrNe(encPtr_to_objRef(cls = globalValue("Ephemeron")), encPtr_to_objRef(nilObj)))
+        ephemeronIndex = oteIndexOf(cls);
+}
+
 void initCommonSymbols(void)
 {
     int i;
@@ -798,16 +2409,62 @@ void initCommonSymbols(void)
         binSyms[i] = newSymbol((char*)binStrs[i]);
 }
 
-encPtr arrayClass = { false,1 };	/* the class Array */
-encPtr intClass = { false,1 };	/* the class Integer */
-encPtr stringClass = { false,1 };	/* the class String */
-encPtr symbolClass = { false,1 };	/* the class Symbol */
+encPtr arrayClass = encIndexLit(1);	/* the class Array */
+encPtr intClass = encIndexLit(1);	/* the class Integer */
+encPtr stringClass = encIndexLit(1);	/* the class String */
+encPtr symbolClass = encIndexLit(1);	/* the class Symbol */
+encPtr charClass = encIndexLit(1);	/* the class Char */
+encPtr floatClass = encIndexLit(1);	/* the class Float */
+encPtr blockClass = encIndexLit(1);	/* the class Block */
+encPtr contextClass = encIndexLit(1);	/* the class Context */
+encPtr linkClass = encIndexLit(1);	/* the class Link */
+encPtr wordArrayClass = encIndexLit(1);	/* the class WordArray */
+
+/*
+On 64-bit hosts, most Floats are kept in their references (as encoded
+Floats) rather than allocated.  An encoded Float keeps the sign and
+mantissa of a double unchanged, but its exponent is only 9 bits wide
+and is rebiased by fltExpBias.  So it covers magnitudes from about
+1e-77 to 1e77, plus zero.  Other doubles are kept in the von Neumann
+space of an object of class Float, as all of them are on 32-bit hosts.
+*/
+#define fltExpBias 767
+#define fltMantBits 52
+#define fltMantMask ((UINT64_C(1) << fltMantBits) - 1)
 
-double floatValue(encPtr o)
+__INLINE__ bool canEncodeFloat(double d, objRef* r)
 {
-    double d;
+    uint64_t bits, expo;
+    if (sizeof(refWord) < sizeof(uint64_t))
+        return(false);
+    (void)memcpy(&bits, &d, sizeof(double));
+    expo = (bits >> fltMantBits) & 0x7FF;
+    if (expo == 0 && (bits & fltMantMask) == 0)
+        ;	/* zero stays zero */
+    else if (expo > fltExpBias && expo - fltExpBias <= 0x1FF)
+        expo -= fltExpBias;
+    else
+        return(false);
+    bits = ((bits >> 63) << 61) | (expo << fltMantBits) | (bits & fltMantMask);
+    r->ptr.wrd = (refWord)((bits << refTagBits) | fltTag);
+    return(true);
+}
 
-    (void)memcpy(&d, addressOf(o), sizeof(double));
+double floatValue(objRef o)
+{
+    double d;
+    uint64_t bits, expo;
+
+    if (isFloatRef(o)) {
+        bits = (uint64_t)(uintptr_t)o.ptr.wrd >> refTagBits;
+        expo = (bits >> fltMantBits) & 0x1FF;
+        if (expo != 0)
+            expo += fltExpBias;
+        bits = ((bits >> 61) << 63) | (expo << fltMantBits) | (bits & fltMantMask);
+        (void)memcpy(&d, &bits, sizeof(double));
+        return d;
+    }
+    (void)memcpy(&d, addressOf(o.ptr), sizeof(double));
     return d;
 }
 
@@ -827,7 +2484,9 @@ encPtr newBlock(void)
     encPtr newObj;
 
     newObj = allocOrefObj(blockSize);
-    classOfPut(newObj, globalValue("Block"));
+    if (ptrEq(encPtr_to_objRef(blockClass), encPtr_to_objRef(nilObj)))
+        blockClass = globalValue("Block");
+    classOfPut(newObj, blockClass);
     return newObj;
 }
 
@@ -846,13 +2505,29 @@ __INLINE__ objRef encVal_to_objRef(encVal v) {
     return result;
 }
 
+/*
+Chars whose values fit in a byte_t are shared, so that scanning a string
+doesn't allocate an object per element.  The table is filled in on
+demand and is traced as a root.  It isn't written to images; a fresh
+table is filled in after an image is read.
+*/
+#define charTableDom 256
+encPtr charTable[charTableDom];
+
 encPtr newChar(int value)
 {
     encPtr newobj;
 
+    if (value >= 0 && value < charTableDom &&
+        oteIndexOf(charTable[value]) != 0)
+        return (charTable[value]);
     newobj = allocOrefObj(1);
     orefOfPut(newobj, 1, encVal_to_objRef(encValueOf(value)));
-    classOfPut(newobj, globalValue("Char"));
+    if (ptrEq(encPtr_to_objRef(charClass), encPtr_to_objRef(nilObj)))
+        charClass = globalValue("Char");
+    classOfPut(newobj, charClass);
+    if (value >= 0 && value < charTableDom)
+        charTable[value] = newobj;
     return (newobj);
 }
 
@@ -898,7 +2573,9 @@ encPtr newContext(int link, encPtr method, encPtr args, encPtr temp)
     encPtr newObj;
 
     newObj = allocOrefObj(contextSize);
-    classOfPut(newObj, globalValue("Context"));
+    if (ptrEq(encPtr_to_objRef(contextClass), encPtr_to_objRef(nilObj)))
+        contextClass = globalValue("Context");
+    classOfPut(newObj, contextClass);
     orefOfPut(newObj, linkPtrInContext, encVal_to_objRef(encValueOf(link)));
     orefOfPut(newObj, methodInContext, encPtr_to_objRef(method));
     orefOfPut(newObj, argumentsInContext, encPtr_to_objRef(args));
@@ -916,14 +2593,19 @@ encPtr newDictionary(int size)
     return newObj;
 }
 
-encPtr newFloat(double d)
+objRef newFloat(double d)
 {
     encPtr newObj;
+    objRef ans;
 
+    if (canEncodeFloat(d, &ans))
+        return ans;
     newObj = allocByteObj(sizeof(double));
     (void)memcpy(addressOf(newObj), &d, sizeof(double));
-    classOfPut(newObj, globalValue("Float"));
-    return newObj;
+    if (ptrEq(encPtr_to_objRef(floatClass), encPtr_to_objRef(nilObj)))
+        floatClass = globalValue("Float");
+    classOfPut(newObj, floatClass);
+    return encPtr_to_objRef(newObj);
 }
 
 encPtr newLink(encPtr key, encPtr value)
@@ -931,7 +2613,9 @@ encPtr newLink(encPtr key, encPtr value)
     encPtr newObj;
 
     newObj = allocOrefObj(3);
-    classOfPut(newObj, globalValue("Link"));
+    if (ptrEq(encPtr_to_objRef(linkClass), encPtr_to_objRef(nilObj)))
+        linkClass = globalValue("Link");
+    classOfPut(newObj, linkClass);
     orefOfPut(newObj, 1, encPtr_to_objRef(key));
     orefOfPut(newObj, 2, encPtr_to_objRef(value));
     return newObj;
@@ -982,6 +2666,11 @@ __INLINE__ encPtr getClass(objRef obj)
             intClass = globalValue("Integer");
         return (intClass);
     }
+    if (isFloatRef(obj)) {
+        if (ptrEq(encPtr_to_objRef(floatClass), encPtr_to_objRef(nilObj)))
+            floatClass = globalValue("Float");
+        return (floatClass);
+    }
     return (classOf(obj.ptr));
 }
 
@@ -993,7 +2682,7 @@ typedef enum tokensyms {
 
 tokentype token = nothing;
 char tokenString[4096];// = {};	/* text of current token */
-int tokenInteger = 0;		/* or character */
+long tokenInteger = 0;		/* or character */
 double tokenFloat = 0.0;
 
 const char* cp = 0;
@@ -1102,18 +2791,21 @@ tokentype nextToken(void)
     }
     else if (isdigit(cc)) {	/* number */
         longresult = cc - '0';
+        tokenFloat = (double)longresult;
         while (nextChar() && isdigit(cc)) {
             *tp++ = cc;
-            longresult = (longresult * 10) + (cc - '0');
+            tokenFloat = (tokenFloat * 10) + (cc - '0');
+            if (longresult <= (INT64_MAX - 9) / 10)
+                longresult = (longresult * 10) + (cc - '0');
+            else
+                longresult = INT64_MAX;	/* not embeddable */
         }
         if (canEmbed(longresult)) {
             tokenInteger = longresult;
             token = intconst;
         }
-        else {
+        else
             token = floatconst;
-            tokenFloat = (double)longresult;
-        }
         if (cc == '.') {		/* possible float */
             if (nextChar() && isdigit(cc)) {
                 *tp++ = '.';
@@ -1255,6 +2947,38 @@ void lexinit(const char* str)
 #define OrBranch 10
 #define SendToSuper 11
 
+#define decodedSpecial 16	/* first opcode for the DoSpecial operations */
+#define decodedSpecialDom 16
+#define decodedExtended 32	/* added to the opcode of an Extended form */
+#define decodedFused 64		/* first opcode for a pair of instructions */
+
+#define MarkAndSend 0
+#define PushArgumentPair 1
+#define PushConstantBinary 2
+#define PushArgumentBinary 3
+#define PushLiteralBinary 4
+#define BinaryBranchIfFalse 5
+#define AssignTemporaryPop 6
+#define PopSelfReturn 7
+
+#define decodedDom (decodedFused + 8)
+
+#define sendCacheWays 4		/* classes remembered per send site */
+#define sendSiteLimit 255	/* sends after this many go without */
+
+/*
+We pack and unpack the instruction word as unsigned, since word_t is
+signed and a site number in the top byte would otherwise come back
+negative once it passes 127.
+*/
+#define decodedWord(op, low, arg, site) \
+    ((word_t)((uint32_t)(op) | ((uint32_t)(low) << 8) | \
+    ((uint32_t)(arg) << 16) | ((uint32_t)(site) << 24)))
+#define decodedOp(w) ((int)((uint32_t)(w) & 0x7F))
+#define decodedLow(w) ((int)(((uint32_t)(w) >> 8) & 0xFF))
+#define decodedArg(w) ((int)(((uint32_t)(w) >> 16) & 0xFF))
+#define decodedSite(w) ((int)((uint32_t)(w) >> 24))
+
 void sysWarn(const char* s1, const char* s2);
 void compilWarn(const char* selector, const char* str1, const char* str2);
 void compilError(const char* selector, const char* str1, const char* str2);
@@ -1345,7 +3069,7 @@ int genLiteral(objRef aLiteral)
     return (literalTop - 1);
 }
 
-void genInteger(int val)
+void genInteger(long val)
 {
     if (val == -1)
         genInstruction(PushConstant, minusOne);
@@ -1434,7 +3158,7 @@ int parseArray(void)
             break;
 
         case floatconst:
-            (void)genLiteral(encPtr_to_objRef(newFloat(tokenFloat)));
+            (void)genLiteral((newFloat(tokenFloat)));
             (void)nextToken();
             break;
 
@@ -1455,7 +3179,7 @@ int parseArray(void)
                 if (token == intconst)
                     (void)genLiteral(encVal_to_objRef(encValueOf(-tokenInteger)));
                 else if (token == floatconst) {
-                    (void)genLiteral(encPtr_to_objRef(newFloat(-tokenFloat)));
+                    (void)genLiteral((newFloat(-tokenFloat)));
                 }
                 else
                     compilError(selector, "negation not followed",
@@ -1515,7 +3239,7 @@ bool term(void)
         (void)nextToken();
     }
     else if (token == floatconst) {
-        genInstruction(PushLiteral, genLiteral(encPtr_to_objRef(newFloat(tokenFloat))));
+        genInstruction(PushLiteral, genLiteral((newFloat(tokenFloat))));
         (void)nextToken();
     }
     else if ((token == binary) && streq(tokenString, "-")) {
@@ -1524,7 +3248,7 @@ bool term(void)
             genInteger(-tokenInteger);
         else if (token == floatconst) {
             genInstruction(PushLiteral,
-                genLiteral(encPtr_to_objRef(newFloat(-tokenFloat))));
+                genLiteral((newFloat(-tokenFloat))));
         }
         else
             compilError(selector, "negation not followed",
@@ -2000,6 +3724,7 @@ bool parse(encPtr method, const char* text, bool saveText)
     byte_t* bp;
 
     lexinit(text);
+    parsing = true;
     parseOk = true;
     blockstat = NotInBlock;
     codeTop = 0;
@@ -2015,8 +3740,12 @@ bool parse(encPtr method, const char* text, bool saveText)
         genInstruction(DoSpecial, PopTop);
         genInstruction(DoSpecial, SelfReturn);
     }
+    /* any decoded instructions and send caches are for the old bytecodes */
+    orefOfPut(method, decodedInMethod, encPtr_to_objRef(nilObj));
+    orefOfPut(method, cachesInMethod, encPtr_to_objRef(nilObj));
     if (!parseOk) {
         orefOfPut(method, bytecodesInMethod, encPtr_to_objRef(nilObj));
+        parsing = false;
     }
     else {
         bytecodes = newByteArray(codeTop);
@@ -2042,6 +3771,7 @@ bool parse(encPtr method, const char* text, bool saveText)
         if (saveText) {
             orefOfPut(method, textInMethod, encPtr_to_objRef(newString(text)));
         }
+        parsing = false;
         return (true);
     }
     return (false);
@@ -2060,15 +3790,16 @@ __INLINE__ objRef unsupportedPrim(objRef arg[])
 }
 
 /*
-Prints the number of available object table entries.
-Always fails.
+Prints the number of available object table entries, if memory
+management is being logged.
+Returns the number.
 Called from Scheduler>>initialize
 */
 objRef primAvailCount(objRef arg[])
 {
-    //fprintf(stderr, "free: %d\n", availCount());
-    //printf("FREE: %d\n", availCount());
-    return(encPtr_to_objRef(nilObj));
+    if (gcLog)
+        (void)fprintf(stderr, "free: %d\n", (int)pointersAvail);
+    return(encVal_to_objRef(encValueOf(pointersAvail)));
 }
 
 /*
@@ -2128,7 +3859,7 @@ Called from Object>>basicSize
 objRef primSize(objRef arg[])
 {
     int i;
-    if (isValue(arg[0]))
+    if (!isIndex(arg[0]))
         i = 0;
     else
         i = countOf(arg[0].ptr);
@@ -2143,6 +3874,8 @@ objRef primHash(objRef arg[])
 {
     if (isValue(arg[0]))
         return(arg[0]);
+    else if (isFloatRef(arg[0]))
+        return(encVal_to_objRef(encValueOf(arg[0].ptr.wrd >> refTagBits)));
     else
         return(encVal_to_objRef(encValueOf(oteIndexOf(arg[0].ptr))));
 }
@@ -2243,7 +3976,8 @@ objRef primIdent(objRef arg[])
 
 /*
 Defines the receiver to be an instance of the first argument.
-Returns the receiver.
+Returns the receiver, or nil if the receiver is nil or an encoded value,
+as when the allocation primitive which made it has failed.
 Called from
   BlockNode>>newBlock
   ByteArray>>asString
@@ -2252,6 +3986,8 @@ Called from
 */
 objRef primClassOfPut(objRef arg[])
 {
+    if (!isIndex(arg[0]) || ptrEq(arg[0], encPtr_to_objRef(nilObj)))
+        return(encPtr_to_objRef(nilObj));
     classOfPut(arg[0].ptr, arg[1].ptr);
     return(arg[0]);
 }
@@ -2287,12 +4023,12 @@ Called from Object>>basicAt:
 */
 objRef primBasicAt(objRef arg[])
 {
-    int i;
-    if (isValue(arg[0]))
+    long i;
+    if (!isIndex(arg[0]))
         return encPtr_to_objRef(nilObj);
     if (!isObjRefs(arg[0].ptr))
         return encPtr_to_objRef(nilObj);
-    if (isIndex(arg[1]))
+    if (!isValue(arg[1]))
         return encPtr_to_objRef(nilObj);
     i = intValueOf(arg[1].val);
     if (i < 1 || i > countOf(arg[0].ptr))
@@ -2302,18 +4038,18 @@ objRef primBasicAt(objRef arg[])
 
 /*
 Returns an encoded representation of the byte_t of the receiver denoted by
-the argument.
+the argument, or nil if the argument is out of range.
 Called from ByteArray>>basicAt:
 */
 objRef primByteAt(objRef arg[])	/*fix*/
 {
-    int i;
-    if (isIndex(arg[1]))
+    long i;
+    if (!isValue(arg[1]))
         sysError("non integer index", "byteAt:");
-    i = byteOf(arg[0].ptr, intValueOf(arg[1].val));
-    if (i < 0)
-        i += 256;
-    return(encVal_to_objRef(encValueOf(i)));
+    i = intValueOf(arg[1].val);
+    if (i < 1 || i > countOf(arg[0].ptr))
+        return(encPtr_to_objRef(nilObj));
+    return(encVal_to_objRef(encValueOf(byteOf(arg[0].ptr, (word_t)i))));
 }
 
 /*
@@ -2377,12 +4113,12 @@ Called from Object>>basicAt:put:
 */
 objRef primBasicAtPut(objRef arg[])
 {
-    int i;
-    if (isValue(arg[0]))
+    long i;
+    if (!isIndex(arg[0]))
         return(encPtr_to_objRef(nilObj));
     if (!isObjRefs(arg[0].ptr))
         return(encPtr_to_objRef(nilObj));
-    if (isIndex(arg[1]))
+    if (!isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     i = intValueOf(arg[1].val);
     if (i < 1 || i > countOf(arg[0].ptr))
@@ -2394,16 +4130,20 @@ objRef primBasicAtPut(objRef arg[])
 /*
 Defines the byte_t of the receiver denoted by the first argument to be a
 decoded representation of the second argument.
-Returns the receiver.
+Returns the receiver, or nil if the first argument is out of range.
 Called from ByteArray>>basicAt:put:
 */
 objRef primByteAtPut(objRef arg[])	/*fix*/
 {
-    if (isIndex(arg[1]))
+    long i;
+    if (!isValue(arg[1]))
         sysError("non integer index", "byteAtPut");
-    if (isIndex(arg[2]))
+    if (!isValue(arg[2]))
         sysError("assigning non int", "to byte");
-    byteOfPut(arg[0].ptr, intValueOf(arg[1].val), intValueOf(arg[2].val));
+    i = intValueOf(arg[1].val);
+    if (i < 1 || i > countOf(arg[0].ptr))
+        return(encPtr_to_objRef(nilObj));
+    byteOfPut(arg[0].ptr, (word_t)i, intValueOf(arg[2].val));
     return(arg[0]);
 }
 
@@ -2429,21 +4169,23 @@ Called from String>>copyFrom:to:
 */
 objRef primCopyFromTo(objRef arg[])	/*fix*/
 {
-    if ((isIndex(arg[1])) || (isIndex(arg[2])))
+    if ((!isValue(arg[1])) || (!isValue(arg[2])))
         sysError("non integer index", "copyFromTo");
     {
         addr src = addressOf(arg[0].ptr);
         word_t len = strlen((char*) src);
-        int pos1 = intValueOf(arg[1].val);
-        int pos2 = intValueOf(arg[2].val);
-        int req = pos2 + 1 - pos1;
+        long pos1 = intValueOf(arg[1].val);
+        long pos2 = intValueOf(arg[2].val);
         word_t act;
         encPtr ans;
         addr tgt;
-        if (pos1 >= 1 && pos1 <= len && req >= 1)
-            act = min(req, strlen(((char*)src) + (pos1 - 1)));
-        else
+        if (pos1 >= 1 && pos1 <= len && pos2 >= pos1)
+            act = min(pos2 - pos1 < len ? (word_t)(pos2 + 1 - pos1) : len,
+                strlen(((char*)src) + (pos1 - 1)));
+        else {
+            pos1 = 1;
             act = 0;
+        }
         ans = allocByteObj(act + 1);
         tgt = addressOf(ans);
         (void)memcpy(tgt, ((byte_t*)src) + (pos1 - 1), act);
@@ -2454,7 +4196,15 @@ objRef primCopyFromTo(objRef arg[])	/*fix*/
     }
 }
 
+#define methodCacheWays 4
+#define methodCacheLimit 0x100000	/* most entries in the global method cache */
+
 void flushCache(encPtr messageToSend, encPtr classPtr);
+void methodCacheResize(word_t entries);
+extern word_t methodCacheSets;
+extern long methodCacheHits;
+extern long methodCacheMisses;
+extern long sendCacheHits;
 
 /*
 Kills the cache slot denoted by the receiver and argument.  The receiver
@@ -2464,7 +4214,7 @@ Called from Class>>install:
 */
 objRef primFlushCache(objRef arg[])
 {
-    if (isValue(arg[0]) || isValue(arg[1]))
+    if (!isIndex(arg[0]) || !isIndex(arg[1]))
         return(encPtr_to_objRef(nilObj));
     flushCache(arg[0].ptr, arg[1].ptr);
     return(arg[0]);
@@ -2488,9 +4238,9 @@ Called from Integer>>asFloat
 */
 objRef primAsFloat(objRef arg[])
 {
-    if (isIndex(arg[0]))
+    if (!isValue(arg[0]))
         return(encPtr_to_objRef(nilObj));
-    return encPtr_to_objRef(newFloat((double)intValueOf(arg[0].val)));
+    return (newFloat((double)intValueOf(arg[0].val)));
 }
 
 /*
@@ -2503,9 +4253,11 @@ Called from
 */
 objRef primSetTimeSlice(objRef arg[])
 {
-    if (isIndex(arg[0]))
+    long n;
+    if (!isValue(arg[0]))
         return(encPtr_to_objRef(nilObj));
-    *counterAddress = intValueOf(arg[0].val);
+    n = intValueOf(arg[0].val);
+    *counterAddress = n > INT32_MAX ? INT32_MAX : n < 0 ? 0 : (int)n;
     return(encPtr_to_objRef(nilObj));
 }
 
@@ -2516,39 +4268,63 @@ Called from Random>>set:
 */
 objRef primSetSeed(objRef arg[])
 {
-    if (isIndex(arg[0]))
+    if (!isValue(arg[0]))
         return(encPtr_to_objRef(nilObj));
     (void)srand((unsigned)intValueOf(arg[0].val));
     return(encPtr_to_objRef(nilObj));
 }
 
+/*
+Returns the shared Char whose value is denoted by the argument, or nil
+if the value doesn't fit in a byte_t.
+Called from Char class>>value:
+*/
+objRef primCharValue(objRef arg[])
+{
+    if (!isValue(arg[0]) ||
+        intValueOf(arg[0].val) < 0 ||
+        intValueOf(arg[0].val) >= charTableDom)
+        return(encPtr_to_objRef(nilObj));
+    return encPtr_to_objRef(newChar((int)intValueOf(arg[0].val)));
+}
+
 /*
 Returns a new object.  The von Neumann space of the new object will be
 presumed to contain a number of objRefs.  The number is denoted by the
 receiver.
+Returns nil if the number is negative or too large for a space.
 Called from
   BlockNode>>newBlock
   Class>>new:
 */
 objRef primAllocOrefObj(objRef arg[])
 {
-    if (isIndex(arg[0]))
+    long n;
+    if (!isValue(arg[0]))
+        return(encPtr_to_objRef(nilObj));
+    n = intValueOf(arg[0].val);
+    if (n < 0 || n > (spaceLimit >> orefScale))
         return(encPtr_to_objRef(nilObj));
-    return encPtr_to_objRef(allocOrefObj(intValueOf(arg[0].val)));
+    return encPtr_to_objRef(allocOrefObj((word_t)n));
 }
 
 /*
 Returns a new object.  The von Neumann space of the new object will be
 presumed to contain a number of bytes.  The number is denoted by the
 receiver.
+Returns nil if the number is negative or too large for a space.
 Called from
   ByteArray>>size:
 */
 objRef primAllocByteObj(objRef arg[])
 {
-    if (isIndex(arg[0]))
+    long n;
+    if (!isValue(arg[0]))
         return(encPtr_to_objRef(nilObj));
-    return encPtr_to_objRef(allocByteObj(intValueOf(arg[0].val)));
+    n = intValueOf(arg[0].val);
+    if (n < 0 || n > spaceLimit)
+        return(encPtr_to_objRef(nilObj));
+    return encPtr_to_objRef(allocByteObj((word_t)n));
 }
 
 /*
@@ -2560,7 +4336,7 @@ Also called for SendBinary bytecodes.
 objRef primAdd(objRef arg[])
 {
     long longresult;
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     longresult = intValueOf(arg[0].val);
     longresult += intValueOf(arg[1].val);
@@ -2579,7 +4355,7 @@ Also called for SendBinary bytecodes.
 objRef primSubtract(objRef arg[])
 {
     long longresult;
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     longresult = intValueOf(arg[0].val);
     longresult -= intValueOf(arg[1].val);
@@ -2597,7 +4373,7 @@ Also called for SendBinary bytecodes.
 */
 objRef primLessThan(objRef arg[])
 {
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     if (intValueOf(arg[0].val) < intValueOf(arg[1].val))
         return(encPtr_to_objRef(trueObj));
@@ -2613,7 +4389,7 @@ Also called for SendBinary bytecodes.
 */
 objRef primGreaterThan(objRef arg[])
 {
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     if (intValueOf(arg[0].val) > intValueOf(arg[1].val))
         return(encPtr_to_objRef(trueObj));
@@ -2628,7 +4404,7 @@ Called for SendBinary bytecodes.
 */
 objRef primLessOrEqual(objRef arg[])
 {
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     if (intValueOf(arg[0].val) <= intValueOf(arg[1].val))
         return(encPtr_to_objRef(trueObj));
@@ -2643,7 +4419,7 @@ Called for SendBinary bytecodes.
 */
 objRef primGreaterOrEqual(objRef arg[])
 {
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     if (intValueOf(arg[0].val) >= intValueOf(arg[1].val))
         return(encPtr_to_objRef(trueObj));
@@ -2658,7 +4434,7 @@ Called for SendBinary bytecodes.
 */
 objRef primEqual(objRef arg[])
 {
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     if (intValueOf(arg[0].val) == intValueOf(arg[1].val))
         return(encPtr_to_objRef(trueObj));
@@ -2673,7 +4449,7 @@ Called for SendBinary bytecodes.
 */
 objRef primNotEqual(objRef arg[])
 {
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     if (intValueOf(arg[0].val) != intValueOf(arg[1].val))
         return(encPtr_to_objRef(trueObj));
@@ -2690,10 +4466,17 @@ Also called for SendBinary bytecodes.
 objRef primMultiply(objRef arg[])
 {
     long longresult;
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    long multiplier;
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     longresult = intValueOf(arg[0].val);
-    longresult *= intValueOf(arg[1].val);
+    multiplier = intValueOf(arg[1].val);
+    /* Encoded values are narrower than a long, but their product needn't be. */
+    if (multiplier != 0 &&
+        (longresult < 0 ? -longresult : longresult) >
+        INT64_MAX / (multiplier < 0 ? -multiplier : multiplier))
+        return(encPtr_to_objRef(nilObj));
+    longresult *= multiplier;
     if (canEmbed(longresult))
         return encVal_to_objRef(encValueOf(longresult));
     else
@@ -2709,7 +4492,7 @@ Also called for SendBinary bytecodes.
 objRef primQuotient(objRef arg[])
 {
     long longresult;
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     if (intValueOf(arg[1].val) == 0)
         return(encPtr_to_objRef(nilObj));
@@ -2729,7 +4512,7 @@ Called for SendBinary bytecodes.
 objRef primRemainder(objRef arg[])
 {
     long longresult;
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     if (intValueOf(arg[1].val) == 0)
         return(encPtr_to_objRef(nilObj));
@@ -2750,7 +4533,7 @@ Also called for SendBinary bytecodes.
 objRef primBitAnd(objRef arg[])
 {
     long longresult;
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     longresult = intValueOf(arg[0].val);
     longresult &= intValueOf(arg[1].val);
@@ -2766,7 +4549,7 @@ Also called for SendBinary bytecodes.
 objRef primBitXor(objRef arg[])
 {
     long longresult;
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     longresult = intValueOf(arg[0].val);
     longresult ^= intValueOf(arg[1].val);
@@ -2783,13 +4566,17 @@ Called from Integer>>bitXor:
 objRef primBitShift(objRef arg[])
 {
     long longresult;
-    if (isIndex(arg[0]) || isIndex(arg[1]))
+    long shift;
+    if (!isValue(arg[0]) || !isValue(arg[1]))
         return(encPtr_to_objRef(nilObj));
     longresult = intValueOf(arg[0].val);
-    if (intValueOf(arg[1].val) < 0)
-        longresult >>= -intValueOf(arg[1].val);
+    shift = intValueOf(arg[1].val);
+    if (shift < 0)
+        longresult >>= (shift < -63 ? 63 : -shift);
+    else if (shift > 63)
+        longresult = 0;
     else
-        longresult <<= intValueOf(arg[1].val);
+        longresult = (long)((uint64_t)longresult << shift);
     return encVal_to_objRef(encValueOf(longresult));
 }
 
@@ -2855,7 +4642,7 @@ Called from Float>>printString
 objRef primAsString(objRef arg[])
 {
     char buffer[32];
-    (void)sprintf(buffer, "%g", floatValue(arg[0].ptr));
+    (void)sprintf(buffer, "%g", floatValue(arg[0]));
     return encPtr_to_objRef(newString(buffer));
 }
 
@@ -2865,7 +4652,7 @@ Called from Float>>ln
 */
 objRef primNaturalLog(objRef arg[])
 {
-    return encPtr_to_objRef(newFloat(log(floatValue(arg[0].ptr))));
+    return (newFloat(log(floatValue(arg[0]))));
 }
 
 /*
@@ -2874,7 +4661,7 @@ Called from Float>>exp
 */
 objRef primERaisedTo(objRef arg[])
 {
-    return encPtr_to_objRef(newFloat(exp(floatValue(arg[0].ptr))));
+    return (newFloat(exp(floatValue(arg[0]))));
 }
 
 /*
@@ -2889,7 +4676,7 @@ objRef primIntegerPart(objRef arg[])
     int j;
     encPtr returnedObject = nilObj;
 #define ndif 12
-    temp = frexp(floatValue(arg[0].ptr), &i);
+    temp = frexp(floatValue(arg[0]), &i);
     if ((i >= 0) && (i <= ndif)) {
         temp = ldexp(temp, i);
         i = 0;
@@ -2904,10 +4691,10 @@ objRef primIntegerPart(objRef arg[])
     orefOfPut(returnedObject, 2, encVal_to_objRef(encValueOf(i)));
 #ifdef trynew
     /* if number is too big it can't be integer anyway */
-    if (floatValue(arg[0].ptr) > 2e9)
+    if (floatValue(arg[0]) > 2e9)
         returnedObject = nilObj;
     else {
-        (void)modf(floatValue(arg[0].ptr), &temp);
+        (void)modf(floatValue(arg[0]), &temp);
         ltemp = (long)temp;
         if (canEmbed(ltemp))
             returnedObject = encValueOf((int)temp);
@@ -2926,9 +4713,9 @@ Called from Float>>+
 objRef primFloatAdd(objRef arg[])
 {
     double result;
-    result = floatValue(arg[0].ptr);
-    result += floatValue(arg[1].ptr);
-    return encPtr_to_objRef(newFloat(result));
+    result = floatValue(arg[0]);
+    result += floatValue(arg[1]);
+    return (newFloat(result));
 }
 
 /*
@@ -2939,9 +4726,9 @@ Called from Float>>-
 objRef primFloatSubtract(objRef arg[])
 {
     double result;
-    result = floatValue(arg[0].ptr);
-    result -= floatValue(arg[1].ptr);
-    return encPtr_to_objRef(newFloat(result));
+    result = floatValue(arg[0]);
+    result -= floatValue(arg[1]);
+    return (newFloat(result));
 }
 
 /*
@@ -2951,7 +4738,7 @@ Called from Float>><
 */
 objRef primFloatLessThan(objRef arg[])
 {
-    if (floatValue(arg[0].ptr) < floatValue(arg[1].ptr))
+    if (floatValue(arg[0]) < floatValue(arg[1]))
         return(encPtr_to_objRef(trueObj));
     else
         return(encPtr_to_objRef(falseObj));
@@ -2964,7 +4751,7 @@ Not called from the image.
 */
 objRef primFloatGreaterThan(objRef arg[])
 {
-    if (floatValue(arg[0].ptr) > floatValue(arg[1].ptr))
+    if (floatValue(arg[0]) > floatValue(arg[1]))
         return(encPtr_to_objRef(trueObj));
     else
         return(encPtr_to_objRef(falseObj));
@@ -2977,7 +4764,7 @@ Not called from the image.
 */
 objRef primFloatLessOrEqual(objRef arg[])
 {
-    if (floatValue(arg[0].ptr) <= floatValue(arg[1].ptr))
+    if (floatValue(arg[0]) <= floatValue(arg[1]))
         return(encPtr_to_objRef(trueObj));
     else
         return(encPtr_to_objRef(falseObj));
@@ -2990,7 +4777,7 @@ Not called from the image.
 */
 objRef primFloatGreaterOrEqual(objRef arg[])
 {
-    if (floatValue(arg[0].ptr) >= floatValue(arg[1].ptr))
+    if (floatValue(arg[0]) >= floatValue(arg[1]))
         return(encPtr_to_objRef(trueObj));
     else
         return(encPtr_to_objRef(falseObj));
@@ -3003,7 +4790,7 @@ Called from Float>>=
 */
 objRef primFloatEqual(objRef arg[])
 {
-    if (floatValue(arg[0].ptr) == floatValue(arg[1].ptr))
+    if (floatValue(arg[0]) == floatValue(arg[1]))
         return(encPtr_to_objRef(trueObj));
     else
         return(encPtr_to_objRef(falseObj));
@@ -3016,7 +4803,7 @@ Not called from the image.
 */
 objRef primFloatNotEqual(objRef arg[])
 {
-    if (floatValue(arg[0].ptr) != floatValue(arg[1].ptr))
+    if (floatValue(arg[0]) != floatValue(arg[1]))
         return(encPtr_to_objRef(trueObj));
     else
         return(encPtr_to_objRef(falseObj));
@@ -3030,9 +4817,9 @@ Called from Float>>*
 objRef primFloatMultiply(objRef arg[])
 {
     double result;
-    result = floatValue(arg[0].ptr);
-    result *= floatValue(arg[1].ptr);
-    return encPtr_to_objRef(newFloat(result));
+    result = floatValue(arg[0]);
+    result *= floatValue(arg[1]);
+    return (newFloat(result));
 }
 
 /*
@@ -3043,15 +4830,29 @@ Called from Float>>/
 objRef primFloatDivide(objRef arg[])
 {
     double result;
-    result = floatValue(arg[0].ptr);
-    result /= floatValue(arg[1].ptr);
-    return encPtr_to_objRef(newFloat(result));
+    result = floatValue(arg[0]);
+    result /= floatValue(arg[1]);
+    return (newFloat(result));
 }
 
 #define MAXFILES 32
 
 FILE* fp[MAXFILES];// = {};
 
+/*
+Returns the index in fp denoted by x, or -1 if x doesn't denote one.
+*/
+__INLINE__ int fileIndexOf(objRef x)
+{
+    long i;
+    if (!isValue(x))
+        return(-1);
+    i = intValueOf(x.val);
+    if (i < 0 || i >= MAXFILES)
+        return(-1);
+    return((int)i);
+}
+
 /*
 Opens the file denoted by the first argument, if necessary.  Some of the
 characteristics of the file and/or the operations permitted on it may be
@@ -3061,8 +4862,10 @@ Called from File>>open
 */
 objRef primFileOpen(objRef arg[])
 {
-    int i = intValueOf(arg[0].val);
+    int i = fileIndexOf(arg[0]);
     char* p = (char*) addressOf(arg[1].ptr);
+    if (i < 0)
+        return(encPtr_to_objRef(nilObj));
     if (streq(p, "stdin"))
         fp[i] = stdin;
     else if (streq(p, "stdout"))
@@ -3072,7 +4875,7 @@ objRef primFileOpen(objRef arg[])
     else {
         char* q = (char*) addressOf(arg[2].ptr);
         char* r = strchr(q, 'b');
-        encPtr s = { false,1 };
+        encPtr s = encIndexLit(1);
         if (r == NULL) {
             int t = strlen(q);
             s = allocByteObj(t + 2);
@@ -3082,8 +4885,6 @@ objRef primFileOpen(objRef arg[])
             q = r;
         }
         fp[i] = fopen(p, q);
-        if (r == NULL)
-            isVolatilePut(s, false);
     }
     if (fp[i] == NULL)
         return(encPtr_to_objRef(nilObj));
@@ -3098,7 +4899,9 @@ Called from File>>close
 */
 objRef primFileClose(objRef arg[])
 {
-    int i = intValueOf(arg[0].val);
+    int i = fileIndexOf(arg[0]);
+    if (i < 0)
+        return(encPtr_to_objRef(nilObj));
     if (fp[i])
         (void)fclose(fp[i]);
     fp[i] = NULL;
@@ -3117,8 +4920,8 @@ used only in connection with building an initial image.
 */
 objRef primFileIn(objRef arg[])
 {
-    int i = intValueOf(arg[0].val);
-    if (fp[i])
+    int i = fileIndexOf(arg[0]);
+    if (i >= 0 && fp[i])
         coldFileIn(arg[0].val);
     return(encPtr_to_objRef(nilObj));
 }
@@ -3138,11 +4941,13 @@ Called from File>>getString
 */
 objRef primGetString(objRef arg[])
 {
-    int i = intValueOf(arg[0].val);
+    int i = fileIndexOf(arg[0]);
     int j;
     char buffer[4096];
-    if (!fp[i])
+    if (i < 0 || !fp[i])
         return(encPtr_to_objRef(nilObj));
+    if (fp[i] == stdin)
+        (void)sweepStep(0);	/* we're idle until the user types */
     j = 0;
     buffer[j] = '\0';
     while (1) {
@@ -3167,17 +4972,22 @@ objRef primGetString(objRef arg[])
     return encPtr_to_objRef(newString(buffer));
 }
 
+/*
+Images start with a version number, which changes whenever the layout
+of an object table entry or of an object reference does.
+*/
+#define imageVersion 8
+
 __INLINE__ bool irf(FILE* tag, addr dat, word_t len) {
     return((fread(dat, len, 1, tag) == 1) ? true : false);
 }
 
 encPtr imageRead(FILE* tag)
 {
-    encVal ver = encValueOf(3);
+    encVal ver = encValueOf(imageVersion);
     encVal val;
     word_t ord;
     otbEnt* otp;
-    ot2Ent* o2p;
     encPtr ptr;
     word_t len;
     if (irf(tag, &val, sizeof val) != true)
@@ -3186,6 +4996,10 @@ encPtr imageRead(FILE* tag)
         goto fail;
     while (irf(tag, &val, sizeof val) == true) {
         ord = intValueOf(val);
+        if (ord < otbLob || ord > otbLimit)
+            goto fail;
+        if (ord > otbHib)
+            extendObjectTable(ord | (otbChunk - 1));
         otp = &objTbl[ord];
 #if 0
         if (irf(tag, (void*)otp, sizeof(addr)) != true)
@@ -3193,12 +5007,14 @@ encPtr imageRead(FILE* tag)
 #endif
         if (irf(tag, ((byte_t*)otp) + sizeof(addr), sizeof(otbEnt) - sizeof(addr)) != true)
             goto fail;
-        o2p = &ob2Tbl[ord];
-        if (irf(tag, o2p, sizeof(ot2Ent)) != true)
-            goto fail;
         ptr = encIndexOf(ord);
+        isMarkedPut(ptr, false);
+        isYoungPut(ptr, false);
+        isRememberedPut(ptr, false);
+        isScavengedPut(ptr, false);
+        isFinalPut(ptr, false);
         if ((len = spaceOf(ptr))) {
-            addressOfPut(ptr, newStorage(len));
+            addressOfPut(ptr, newSpace(len));
             if (irf(tag, addressOf(ptr), len) != true)
                 goto fail;
         }
@@ -3214,12 +5030,12 @@ __INLINE__ bool iwf(FILE* tag, addr dat, word_t len) {
 
 encPtr imageWrite(FILE* tag)
 {
-    encVal val = encValueOf(3);
+    encVal val = encValueOf(imageVersion);
     word_t ord;
     encPtr ptr;
     otbEnt* otp;
-    ot2Ent* o2p;
     word_t len;
+    (void)sweepStep(0);
     if (iwf(tag, &val, sizeof val) != true)
         goto fail;
     for (ord = otbLob; ord <= otbHib; ord++) {
@@ -3236,9 +5052,6 @@ encPtr imageWrite(FILE* tag)
 #endif
         if (iwf(tag, ((byte_t*)otp) + sizeof(addr), sizeof(otbEnt) - sizeof(addr)) != true)
             goto fail;
-        o2p = &ob2Tbl[ord];
-        if (iwf(tag, o2p, sizeof(ot2Ent)) != true)
-            goto fail;
         if ((len = spaceOf(ptr)))
             if (iwf(tag, addressOf(ptr), len) != true)
                 goto fail;
@@ -3256,8 +5069,8 @@ Called from File>>saveImage
 */
 objRef primImageWrite(objRef arg[])
 {
-    int i = intValueOf(arg[0].val);
-    if (fp[i])
+    int i = fileIndexOf(arg[0]);
+    if (i >= 0 && fp[i])
         return encPtr_to_objRef(imageWrite(fp[i]));
     else
         return(encPtr_to_objRef(nilObj));
@@ -3271,8 +5084,8 @@ Called from File>>printNoReturn:
 */
 objRef primPrintWithoutNL(objRef arg[])
 {
-    int i = intValueOf(arg[0].val);
-    if (!fp[i])
+    int i = fileIndexOf(arg[0]);
+    if (i < 0 || !fp[i])
         return(encPtr_to_objRef(nilObj));
     (void)fputs((char*) addressOf(arg[1].ptr), fp[i]);
     (void)fflush(fp[i]);
@@ -3287,8 +5100,8 @@ Called from File>>print:
 */
 objRef primPrintWithNL(objRef arg[])
 {
-    int i = intValueOf(arg[0].val);
-    if (!fp[i])
+    int i = fileIndexOf(arg[0]);
+    if (i < 0 || !fp[i])
         return(encPtr_to_objRef(nilObj));
     (void)fputs((char*) addressOf(arg[1].ptr), fp[i]);
     (void)fputc('\n', fp[i]);
@@ -3298,12 +5111,18 @@ objRef primPrintWithNL(objRef arg[])
 /*
 Defines the trace vector slot denoted by the receiver to be the value
 denoted by the argument.
-Returns the receiver.
+Returns the receiver, or nil if there's no such slot.
 Not usually called from the image.
 */
 objRef primSetTrace(objRef arg[])
 {
-    traceVect[intValueOf(arg[0].val)] = intValueOf(arg[1].val);
+    long i;
+    if (!isValue(arg[0]) || !isValue(arg[1]))
+        return(encPtr_to_objRef(nilObj));
+    i = intValueOf(arg[0].val);
+    if (i < 0 || i >= traceSize)
+        return(encPtr_to_objRef(nilObj));
+    traceVect[i] = intValueOf(arg[1].val) != 0;
     return(arg[0]);
 }
 
@@ -3336,8 +5155,334 @@ objRef primReclaim(objRef arg[])
         return(encPtr_to_objRef(nilObj));
 }
 
+/*
+Memory management and the method cache can be tuned while the image runs
+as well as from the command line (see gcOption).  Each setting is known by its position in
+gcSettingNames.
+*/
+const char* gcSettingNames[] = {
+    NULL, "-gcpause", "-gcthreads", "-gccompact",
+    "-gcmaxheap", "-gctrigger", "-gcgrowth", "-gclog", "-methodcache", NULL
+};
+
+long gcSettingOf(long which)
+{
+    switch (which) {
+    case 1: return(markBudget);
+    case 2: return(gcThreads);
+    case 3: return(compactRatio);
+    case 4: return((long)heapLimit);
+    case 5: return((long)gcTrigger);
+    case 6: return(otbGrowth);
+    case 7: return(gcLog);
+    case 8: return((long)(methodCacheSets * methodCacheWays));
+    }
+    return(-1);
+}
+
+bool gcSettingPut(long which, long value)
+{
+    /* all but the sizes in address units are kept in a word_t */
+    if (value < 0 || (which != 4 && which != 5 && value > INT32_MAX))
+        return(false);
+    switch (which) {
+    case 1:
+        markBudget = (word_t)value;
+        break;
+    case 2:
+        gcThreads = value < 1 ? 1 : (word_t)value;
+#ifndef L2_SMALLTALK_NO_THREADS
+        if (gcThreads > gcThreadsMax)
+            gcThreads = gcThreadsMax;
+#endif
+        break;
+    case 3:
+        compactRatio = (word_t)value;
+        break;
+    case 4:
+        heapLimit = (size_t)value;
+        heapCheckAt = 0;
+        break;
+    case 5:
+        gcTrigger = (size_t)value;
+        break;
+    case 6:
+        if (value == 0)
+            return(false);
+        otbGrowth = (word_t)value;
+        break;
+    case 7:
+        gcLog = value != 0;
+        break;
+    case 8:
+        if (value == 0 || value > methodCacheLimit)
+            return(false);
+        methodCacheResize((word_t)value);
+        break;
+    default:
+        return(false);
+    }
+    return(true);
+}
+
+/*
+Returns the memory management setting denoted by the receiver (see
+gcSettingNames) as it was before being defined to be the argument's
+value.  The setting is left alone if the argument is nil.
+Returns nil if there's no such setting or the value isn't suitable.
+Called from
+  Smalltalk>>gcSetting:
+  Smalltalk>>gcSetting:put:
+*/
+objRef primGCSetting(objRef arg[])
+{
+    long old;
+    if (!isValue(arg[0]))
+        return(encPtr_to_objRef(nilObj));
+    old = gcSettingOf(intValueOf(arg[0].val));
+    if (old < 0)
+        return(encPtr_to_objRef(nilObj));
+    if (ptrNe(arg[1], encPtr_to_objRef(nilObj)))
+        if (!isValue(arg[1]) ||
+            !gcSettingPut(intValueOf(arg[0].val), intValueOf(arg[1].val)))
+            return(encPtr_to_objRef(nilObj));
+    return(encVal_to_objRef(encValueOf(old)));
+}
+
+/*
+Registers the receiver as the Semaphore to be signalled when space runs
+low (see heapCheck).
+Returns the receiver.
+Called from Smalltalk>>lowSpaceSemaphore:
+*/
+objRef primLowSpace(objRef arg[])
+{
+    if (!isIndex(arg[0]))
+        return(encPtr_to_objRef(nilObj));
+    lowSpaceSem = arg[0].ptr;
+    return(arg[0]);
+}
+
+/*
+Returns the registered low space Semaphore if space has run low since
+the last time it was returned; nil otherwise.
+Called from Scheduler>>run
+*/
+objRef primLowSpaceWanted(objRef arg[])
+{
+    if (!lowSpaceWanted)
+        return(encPtr_to_objRef(nilObj));
+    lowSpaceWanted = false;
+    return(encPtr_to_objRef(lowSpaceSem));
+}
+
+/*
+Registers the receiver as the Semaphore to be signalled when objects
+have been queued for finalization (see queueFinalizers).
+Returns the receiver.
+Called from Smalltalk>>finalizationLoop:
+*/
+objRef primFinalSem(objRef arg[])
+{
+    if (!isIndex(arg[0]))
+        return(encPtr_to_objRef(nilObj));
+    finalSem = arg[0].ptr;
+    return(arg[0]);
+}
+
+/*
+Returns the registered finalization Semaphore if objects have been
+queued for finalization since the last time it was returned; nil
+otherwise.
+Called from Scheduler>>run
+*/
+objRef primFinalWanted(objRef arg[])
+{
+    if (!finalWanted || ptrEq(encPtr_to_objRef(finalSem), encPtr_to_objRef(nilObj)))
+        return(encPtr_to_objRef(nilObj));
+    finalWanted = false;
+    return(encPtr_to_objRef(finalSem));
+}
+
+/*
+Removes an object from the finalization queue.
+Returns the object, or nil if the queue is empty.
+Called from Smalltalk>>finalizationLoop:
+*/
+objRef primFinalNext(objRef arg[])
+{
+    if (finalQueue.top == 0)
+        return(encPtr_to_objRef(nilObj));
+    return(encPtr_to_objRef(finalQueue.ptrs[--finalQueue.top]));
+}
+
+/*
+Registers the receiver to be sent finalize once it's found to be
+unreachable.  An object is registered only once however many times this
+is asked for, until it has been queued.
+Returns the receiver.
+Called from Smalltalk>>registerForFinalization:
+*/
+objRef primFinalRegister(objRef arg[])
+{
+    if (!isIndex(arg[0]) || ptrEq(arg[0], encPtr_to_objRef(nilObj)))
+        return(encPtr_to_objRef(nilObj));
+    if (isFinal(arg[0].ptr))
+        return(arg[0]);
+    isFinalPut(arg[0].ptr, true);
+    ptrListPush(&finalList, arg[0].ptr);
+    return(arg[0]);
+}
+
+__INLINE__ objRef statOf(long n)
+{
+    if (canEmbed(n))
+        return(encVal_to_objRef(encValueOf(n)));
+    return(newFloat((double)n));
+}
+
+/*
+Returns an Array of memory management statistics (see gcEnd):  the
+numbers of scavenges, mark increments, full collections and
+compactions; the total and longest pause; the object table entries and
+bytes freed in all and by the last sweep or scavenge; the entries now
+available, the bytes in spaces and the size of the object table; and an
+Array of the pause histogram.
+Called from Smalltalk>>gcStatistics
+*/
+objRef primGCStatistics(objRef arg[])
+{
+    encPtr ans, hist;
+    word_t i;
+    hist = newArray(gcHistDom);
+    for (i = 0; i != gcHistDom; i++)
+        orefOfPut(hist, i + 1, statOf(gcPauseHist[i]));
+    ans = newArray(gcKindDom + 10);
+    for (i = 0; i != gcKindDom; i++)
+        orefOfPut(ans, i + 1, statOf(gcCount[i]));
+    orefOfPut(ans, gcKindDom + 1, statOf(gcPauseSum));
+    orefOfPut(ans, gcKindDom + 2, statOf(gcPauseMax));
+    orefOfPut(ans, gcKindDom + 3, statOf(gcFreedSum));
+    orefOfPut(ans, gcKindDom + 4, statOf(gcBytesSum));
+    orefOfPut(ans, gcKindDom + 5, statOf(gcFreedLast));
+    orefOfPut(ans, gcKindDom + 6, statOf(gcBytesLast));
+    orefOfPut(ans, gcKindDom + 7, statOf((long)pointersAvail));
+    orefOfPut(ans, gcKindDom + 8, statOf((long)heapBytes));
+    orefOfPut(ans, gcKindDom + 9, statOf((long)otbDom));
+    orefOfPut(ans, gcKindDom + 10, encPtr_to_objRef(hist));
+    return(encPtr_to_objRef(ans));
+}
+
+/*
+A census counts the objects of each class and the bytes of their
+spaces, by walking the object table with a pair of counters for every
+entry which might be a class.  The classes with instances are sorted by
+bytes, most first.
+Returns the number of classes with instances.
+*/
+typedef struct {
+    word_t cls;
+    long   count;
+    long   bytes;
+} censusEnt;
+
+int compareCensus(const void* x, const void* y)
+{
+    const censusEnt* a = (const censusEnt*)x;
+    const censusEnt* b = (const censusEnt*)y;
+    if (a->bytes != b->bytes)
+        return((a->bytes < b->bytes) - (a->bytes > b->bytes));
+    return((a->count < b->count) - (a->count > b->count));
+}
+
+word_t takeCensus(censusEnt** ans)
+{
+    censusEnt* tab = (censusEnt*) calloc(otbDom, sizeof(censusEnt));
+    word_t ord, cls;
+    word_t n = 0;
+    encPtr ptr;
+    assert(tab != NULL);
+    for (ord = otbLob + 1; ord <= otbHib; ord++) {
+        ptr = encIndexOf(ord);
+        if (isAvail(ptr))
+            continue;
+        cls = oteIndexOf(classOf(ptr));
+        if (cls > otbHib)
+            continue;
+        tab[cls].count++;
+        tab[cls].bytes += spaceOf(ptr);
+    }
+    for (ord = otbLob; ord <= otbHib; ord++)
+        if (tab[ord].count) {
+            tab[n] = tab[ord];
+            tab[n++].cls = ord;
+        }
+    qsort(tab, n, sizeof(censusEnt), compareCensus);
+    *ans = tab;
+    return(n);
+}
+
+/*
+Takes a census of the objects left after memory reclamation.  Young
+objects which are garbage are still counted, since only a scavenge
+frees them.
+Returns an Array with a class, its number of instances and the bytes
+of their spaces for each class with instances, the classes with the
+most bytes first.
+Called from Smalltalk>>census
+*/
+objRef primCensus(objRef arg[])
+{
+    censusEnt* tab;
+    encPtr ans;
+    word_t i, n;
+    (void)reclaim(true);
+    (void)sweepStep(0);
+    n = takeCensus(&tab);
+    ans = newArray(3 * n);
+    for (i = 0; i != n; i++) {
+        orefOfPut(ans, 3 * i + 1, encPtr_to_objRef(encIndexOf(tab[i].cls)));
+        orefOfPut(ans, 3 * i + 2, statOf(tab[i].count));
+        orefOfPut(ans, 3 * i + 3, statOf(tab[i].bytes));
+    }
+    free(tab);
+    return(encPtr_to_objRef(ans));
+}
+
+/*
+Returns an Array of method cache statistics (see methodCacheResize):
+the number of entries in the global method cache and of entries in each
+set, the lookups which hit and which missed it, and the sends which
+found their Method in the inline cache of their site instead.
+Called from Smalltalk>>methodCacheStatistics
+*/
+objRef primMethodCacheStatistics(objRef arg[])
+{
+    encPtr ans;
+    ans = newArray(5);
+    orefOfPut(ans, 1, statOf((long)(methodCacheSets * methodCacheWays)));
+    orefOfPut(ans, 2, statOf(methodCacheWays));
+    orefOfPut(ans, 3, statOf(methodCacheHits));
+    orefOfPut(ans, 4, statOf(methodCacheMisses));
+    orefOfPut(ans, 5, statOf(sendCacheHits));
+    return(encPtr_to_objRef(ans));
+}
+
+/*
+Causes memory reclamation, followed by compaction (see compact) before
+the next bytecode is executed.
+Returns the receiver.
+Not usually called from the image.
+*/
+objRef primCompact(objRef arg[])
+{
+    (void)reclaim(true);
+    compactWanted = true;
+    return(arg[0]);
+}
+
 FILE* logTag = NULL;
-encPtr logBuf = { false,1 };
+encPtr logBuf = encIndexLit(1);
 addr logPtr = 0;
 word_t logSiz = 0;
 word_t logPos = 0;
@@ -3345,6 +5490,7 @@ word_t logPos = 0;
 void logInit()
 {
     logPos = 0;
+    logPtr = addressOf(logBuf);
 }
 
 void logByte(byte_t val)
@@ -3353,7 +5499,6 @@ void logByte(byte_t val)
         encPtr newBuf = allocByteObj(logSiz + 128);
         addr newPtr = addressOf(newBuf);
         (void)memcpy(newPtr, logPtr, logSiz);
-        isVolatilePut(logBuf, false);
         logBuf = newBuf;
         logPtr = newPtr;
         logSiz = countOf(logBuf);
@@ -3405,7 +5550,7 @@ objRef primLogChunk(objRef arg[])
     return(arg[0]);
 }
 
-encPtr bwsBuf = { false,1 };
+encPtr bwsBuf = encIndexLit(1);
 addr bwsPtr = 0;
 word_t bwsSiz = 0;
 word_t bwsPos = 0;
@@ -3413,6 +5558,7 @@ word_t bwsPos = 0;
 void bwsInit(void)
 {
     bwsPos = 0;
+    bwsPtr = addressOf(bwsBuf);
 }
 
 void bwsNextPut(byte_t val)
@@ -3421,7 +5567,6 @@ void bwsNextPut(byte_t val)
         encPtr newBuf = allocByteObj(bwsSiz + 128);
         addr newPtr = addressOf(newBuf);
         (void)memcpy(newPtr, bwsPtr, bwsSiz);
-        isVolatilePut(bwsBuf, false);
         bwsBuf = newBuf;
         bwsPtr = newPtr;
         bwsSiz = countOf(bwsBuf);
@@ -3466,8 +5611,7 @@ objRef primGetChunk(objRef arg[])
     int i;
     FILE* tag;
     int val;
-    i = intValueOf(arg[0].val);
-    if ((tag = fp[i]) == NULL)
+    if ((i = fileIndexOf(arg[0])) < 0 || (tag = fp[i]) == NULL)
         goto fail;
     bwsInit();
     while ((val = fgetc(tag)) != EOF) {
@@ -3509,8 +5653,7 @@ objRef primPutChunk(objRef arg[])
 {
     int i;
     FILE* tag;
-    i = intValueOf(arg[0].val);
-    if ((tag = fp[i]) == NULL)
+    if ((i = fileIndexOf(arg[0])) < 0 || (tag = fp[i]) == NULL)
         goto fail;
     bwsInit();
     {
@@ -3614,7 +5757,7 @@ primitiveMethod* primitiveVector[primVectDom] = {
     /*054*/ &unsupportedPrim,
     /*055*/ &primSetSeed,
     /*056*/ &unsupportedPrim,
-    /*057*/ &unsupportedPrim,
+    /*057*/ &primCharValue,
     /*058*/ &primAllocOrefObj,
     /*059*/ &primAllocByteObj,
     /*060*/ &primAdd,
@@ -3687,16 +5830,16 @@ primitiveMethod* primitiveVector[primVectDom] = {
     /*127*/ &primImageWrite,
     /*128*/ &primPrintWithoutNL,
     /*129*/ &primPrintWithNL,
-    /*130*/ &unsupportedPrim,
-    /*131*/ &unsupportedPrim,
-    /*132*/ &unsupportedPrim,
-    /*133*/ &unsupportedPrim,
-    /*134*/ &unsupportedPrim,
-    /*135*/ &unsupportedPrim,
-    /*136*/ &unsupportedPrim,
-    /*137*/ &unsupportedPrim,
-    /*138*/ &unsupportedPrim,
-    /*139*/ &unsupportedPrim,
+    /*130*/ &primGCSetting,
+    /*131*/ &primLowSpace,
+    /*132*/ &primLowSpaceWanted,
+    /*133*/ &primFinalSem,
+    /*134*/ &primFinalWanted,
+    /*135*/ &primFinalNext,
+    /*136*/ &primFinalRegister,
+    /*137*/ &primGCStatistics,
+    /*138*/ &primCensus,
+    /*139*/ &primMethodCacheStatistics,
     /*140*/ &unsupportedPrim,
     /*141*/ &unsupportedPrim,
     /*142*/ &unsupportedPrim,
@@ -3712,7 +5855,7 @@ primitiveMethod* primitiveVector[primVectDom] = {
     /*152*/ &primError,
     /*153*/ &primReclaim,
     /*154*/ &primLogChunk,
-    /*155*/ &unsupportedPrim,
+    /*155*/ &primCompact,
     /*156*/ &unsupportedPrim,
     /*157*/ &primGetChunk,
     /*158*/ &primPutChunk,
@@ -3786,10 +5929,8 @@ void coldClassDef(encPtr strRef)
         for (i = 0; i < instTop; i++)
             orefOfPut(varVec, i + 1, encPtr_to_objRef(instVars[i]));
         orefOfPut(classObj, variablesInClass, encPtr_to_objRef(varVec));
-        isVolatilePut(instStr, false);
     }
     orefOfPut(classObj, sizeInClass, encVal_to_objRef(encValueOf(size)));
-    isVolatilePut(superStr, false);
 }
 
 #define MethodTableSize 39
@@ -3830,10 +5971,6 @@ void coldMethods(encVal tagRef)
             selector = orefOf(theMethod, messageInMethod).ptr;
             nameTableInsert(methTable, oteIndexOf(selector), selector, theMethod);
         }
-        else {
-            /* get rid of unwanted method */
-            isVolatilePut(theMethod, false);
-        }
     }
 }
 
@@ -3868,26 +6005,33 @@ copies of its reference and a pointer to its instance variable space.
 We also keep separate pointers to the literal and bytecode spaces of a
 Method.  The "instruction pointer" is kept as an offset into the
 bytecode space.  An explicit counter supports a rudimentary multi-
-programming scheme.
+programming scheme.  Every pointer into a space is kept alongside the
+object whose space it is, so that the pointers can be recomputed if a
+scavenge moves spaces.  Activations of the interpreter nest (see
+primExecute), so each one links to the one it interrupted.
 */
-typedef struct {
+typedef struct execState {
     encPtr  pcso;     /* process object */
-  /*encPtr  pso;      process stack object */
+    encPtr  pso;      /* process stack object */
     objRef* psb;      /* process stack base address */
     objRef* pst;      /* process stack top address */
     encPtr  cxto;     /* context or process stack object */
     objRef* cxtb;     /* context or process stack base address */
     int     rtnp;     /* offset at which to store a returned object */
+    encPtr  argo;     /* argument object */
     objRef* argb;     /* argument base address */
+    encPtr  tmpo;     /* temporary object */
     objRef* tmpb;     /* temporary base address */
     objRef  rcvo;     /* receiver object */
     objRef* rcvb;     /* receiver base address */
-  /*encPtr  lito;     literal object */
+    encPtr  lito;     /* literal object */
     objRef* litb;     /* literal base address */
-  /*encPtr  byto;     bytecode object */
-    byte_t* bytb;     /* bytecode base address - 1 */
+    encPtr  byto;     /* decoded instruction object */
+    encPtr  sndo;     /* send cache object */
+    word_t* bytb;     /* decoded instruction base address - 1 */
     word_t    byteOffset;
     int     timeSliceCounter;
+    struct execState* outer;
 } execState;
 #define processObject pcso
 #define contextObject cxto
@@ -3899,16 +6043,6 @@ __INLINE__ objRef processStackAt(execState* es, int n)
     return(*(es->psb + (n - 1)));
 }
 
-__INLINE__ objRef stackTop(execState* es)
-{
-    return(*es->pst);
-}
-
-__INLINE__ void stackTopPut(execState* es, objRef x)
-{
-    *es->pst = x;
-}
-
 __INLINE__ void stackTopFree(execState* es)
 {
     *es->pst-- = encPtr_to_objRef(nilObj);
@@ -3933,87 +6067,21 @@ __INLINE__ objRef ipop(execState* es)
 
 __INLINE__ objRef argumentAt(execState* es, int n)
 {
-    return(*(es->argb + n));
-}
-
-__INLINE__ objRef temporaryAt(execState* es, int n)
-{
-    return(*(es->tmpb + n));
-}
-
-__INLINE__ void temporaryAtPut(execState* es, int n, objRef x)
-{
-    *(es->tmpb + n) = x;
-}
-
-__INLINE__ objRef receiverAt(execState* es, int n)
-{
-    return(*(es->rcvb + n));
-}
-
-__INLINE__ void receiverAtPut(execState* es, int n, objRef x)
-{
-    *(es->rcvb + n) = x;
-}
-
-__INLINE__ objRef literalAt(execState* es, int n)
-{
-    return(*(es->litb + n));
-}
-
-__INLINE__ byte_t nextByte(execState* es)
-{
-    return(*(es->bytb + es->byteOffset++));
-}
-
-bool unsupportedByte(execState* es, int low)
-{
-    sysError("invalid bytecode", "");
-    return(false);
-}
-
-/*
-Pushes the value of one of the receiver's instance variables onto the
-process stack.  The instruction operand denotes which one.
-*/
-bool bytePushInstance(execState* es, int low)
-{
-    ipush(es, receiverAt(es, low));
-    return(true);
-}
-
-/*
-Pushes the value of one of the message's argument variables onto the
-process stack.  The instruction operand denotes which one.  Note that
-the receiver is accessed as the "zeroth" argument.
-*/
-bool bytePushArgument(execState* es, int low)
-{
-    ipush(es, argumentAt(es, low));
-    return(true);
+    return(*(es->argb + n));
 }
 
-/*
-Pushes the value of one of the method's temporary variables onto the
-process stack.  The instruction operand denotes which one.
-*/
-bool bytePushTemporary(execState* es, int low)
+__INLINE__ objRef literalAt(execState* es, int n)
 {
-    ipush(es, temporaryAt(es, low));
-    return(true);
+    return(*(es->litb + n));
 }
 
-/*
-Pushes one of the method's literal values onto the process stack.  The
-instruction operand denotes which one.  See also "bytePushConstant".
-*/
-bool bytePushLiteral(execState* es, int low)
+bool unsupportedByte(execState* es, int low)
 {
-    ipush(es, literalAt(es, low));
-    return(true);
+    sysError("invalid bytecode", "");
+    return(false);
 }
 
-encPtr method = { true,0 };
+encPtr method = encValueLit(0);
 
 encPtr copyFrom(encPtr obj, int start, int size)
 {
@@ -4036,15 +6104,19 @@ void fetchLinkageState(execState* es)
     if (ptrEq(encPtr_to_objRef(es->contextObject), encPtr_to_objRef(nilObj))) {
         es->contextObject = processStack;
         es->cxtb = es->psb;
+        es->argo = processStack;
         es->argb = es->cxtb + (es->returnPoint - 1);
         method = processStackAt(es, linkPointer + 3).ptr;
+        es->tmpo = processStack;
         es->tmpb = es->cxtb + linkPointer + 4;
     }
     else {			/* read from context object */
         es->cxtb = (objRef*)addressOf(es->contextObject);
         method = orefOf(es->contextObject, methodInContext).ptr;
-        es->argb = (objRef*)addressOf(orefOf(es->contextObject, argumentsInContext).ptr);
-        es->tmpb = (objRef*)addressOf(orefOf(es->contextObject, temporariesInContext).ptr);
+        es->argo = orefOf(es->contextObject, argumentsInContext).ptr;
+        es->argb = (objRef*)addressOf(es->argo);
+        es->tmpo = orefOf(es->contextObject, temporariesInContext).ptr;
+        es->tmpb = (objRef*)addressOf(es->tmpo);
     }
 }
 
@@ -4059,10 +6131,186 @@ __INLINE__ void fetchReceiverState(execState* es)
         es->rcvb = (objRef*)0;
 }
 
+/*
+We translate a Method's bytecodes into instructions of one word each the
+first time it is run, and keep them in the Method as a WordArray, so
+that the image sees them as an ordinary object.  The word for an
+instruction is at the offset of its first byte, so offsets kept in
+process stacks, contexts and blocks are the same for both; the words of
+operand bytes are left zero, which is not a valid instruction.  A word
+holds the opcode, its operand and its extra operand: the target of a
+branch, the number of a primitive, or the literal of a send to super.
+The operations of DoSpecial have opcodes of their own from
+decodedSpecial, and an Extended form has decodedExtended added to its
+opcode, so that the length of an instruction follows from its opcode.
+Sends other than to super are numbered as sites for the inline caches of
+"lookupSiteAndEnter", which are made along with the instructions, and a
+send's word holds its site in its top byte.  parse discards the
+instructions and caches when it compiles into a Method again.
+
+We also fuse the pairs of short instructions which are run most often,
+as found by counting pairs over the base library and our benchmarks:
+marking arguments then sending, pushing two arguments, pushing a small
+constant, an argument or a literal then sending a binary message, a
+comparison then BranchIfFalse, storing a temporary then popping it, and
+popping then returning self.  The fused opcode replaces the word of the
+first instruction only, with the operand of the first and that of the
+second as its operands.  The word of the second instruction is left as
+it was, so a branch to it still works, and the fused instruction can
+fall back to running just the first instruction and let the second run
+by itself, as it does when a comparison isn't of SmallIntegers.
+*/
+word_t fuseInstructions(word_t first, word_t second)
+{
+    int low = decodedLow(first);
+    int arg = decodedLow(second);
+    /* at most one of the pair is a send */
+    int site = decodedSite(first) | decodedSite(second);
+    switch (decodedOp(first)) {
+    case MarkArguments:
+        if (decodedOp(second) == SendMessage)
+            return(decodedWord(decodedFused + MarkAndSend, low, arg, site));
+        break;
+    case PushArgument:
+        if (decodedOp(second) == PushArgument)
+            return(decodedWord(decodedFused + PushArgumentPair, low, arg, site));
+        if (decodedOp(second) == SendBinary)
+            return(decodedWord(decodedFused + PushArgumentBinary, low, arg, site));
+        break;
+    case PushConstant:
+        if (decodedOp(second) == SendBinary && low != contextConst && low <= falseConst)
+            return(decodedWord(decodedFused + PushConstantBinary, low, arg, site));
+        break;
+    case PushLiteral:
+        if (decodedOp(second) == SendBinary)
+            return(decodedWord(decodedFused + PushLiteralBinary, low, arg, site));
+        break;
+    case SendBinary:
+        /* the comparisons, from < to ~= */
+        if (decodedOp(second) == decodedSpecial + BranchIfFalse && low >= 2 && low <= 7)
+            return(decodedWord(decodedFused + BinaryBranchIfFalse, low, decodedArg(second), site));
+        break;
+    case AssignTemporary:
+        if (decodedOp(second) == decodedSpecial + PopTop)
+            return(decodedWord(decodedFused + AssignTemporaryPop, low, 0, site));
+        break;
+    case decodedSpecial + PopTop:
+        if (decodedOp(second) == decodedSpecial + SelfReturn)
+            return(decodedWord(decodedFused + PopSelfReturn, 0, 0, site));
+        break;
+    }
+    return(first);
+}
+
+encPtr decodeMethod(encPtr aMethod)
+{
+    encPtr bytecodes;
+    encPtr code;
+    encPtr caches;
+    byte_t* bp;
+    word_t* wp;
+    word_t size;
+    word_t i;
+    word_t prev;
+    int len;
+    int op;
+    int ext;
+    int low;
+    int arg;
+    int site;
+    int sites;
+
+    bytecodes = orefOf(aMethod, bytecodesInMethod).ptr;
+    size = ptrEq(encPtr_to_objRef(bytecodes), encPtr_to_objRef(nilObj)) ? 0 : countOf(bytecodes);
+    code = allocWordObj(size + 1);
+    if (ptrEq(encPtr_to_objRef(wordArrayClass), encPtr_to_objRef(nilObj)))
+        wordArrayClass = globalValue("WordArray");
+    classOfPut(code, wordArrayClass);
+    orefOfPut(aMethod, decodedInMethod, encPtr_to_objRef(code));
+    bp = ((byte_t*)addressOf(bytecodes)) - 1;
+    wp = ((word_t*)addressOf(code)) - 1;
+    for (i = 1; i <= size + 1; i++)
+        wp[i] = 0;
+    prev = 0;
+    sites = 0;
+    for (i = 1; i <= size; i += len) {
+        len = 1;
+        ext = 0;
+        low = bp[i] & 0x0F;
+        op = bp[i] >> 4;
+        if (op == Extended) {
+            op = low;
+            low = (i + len <= size) ? bp[i + len] : 0;
+            len++;
+            ext = decodedExtended;
+        }
+        arg = 0;
+        site = 0;
+        if ((op == SendMessage || op == SendUnary || op == SendBinary) && sites != sendSiteLimit)
+            site = ++sites;
+        if (op == DoPrimitive)
+            arg = (i + len <= size) ? bp[i + len++] : 0;
+        else if (op == DoSpecial) {
+            switch (low) {
+            case Branch:
+            case BranchIfTrue:
+            case BranchIfFalse:
+            case AndBranch:
+            case OrBranch:
+            case SendToSuper:
+                arg = (i + len <= size) ? bp[i + len++] : 0;
+                break;
+            }
+            op = (low < decodedSpecialDom) ? decodedSpecial + low : Extended;
+        }
+        if (op == Extended || i + len > size + 1)
+            wp[i] = 0;	/* unsupported, or ran off the end */
+        else
+            wp[i] = decodedWord(op + ext, low, arg, site);
+        if (prev != 0)
+            wp[prev] = fuseInstructions(wp[prev], wp[i]);
+        prev = i;
+    }
+    caches = nilObj;
+    if (sites != 0)
+        caches = newArray(1 + sites * sendCacheWays * 2);
+    orefOfPut(aMethod, cachesInMethod, encPtr_to_objRef(caches));
+    return(code);
+}
+
+/*
+Decoded instructions are in a form which belongs to the build of the
+host, and the send caches were filled under another run's epoch, so we
+discard both from every Method after reading an image.
+*/
+void forgetDecoded(void)
+{
+    encPtr methodClass = globalValue("Method");
+    encPtr ptr;
+    word_t ord;
+    for (ord = otbLob + 1; ord <= otbHib; ord++) {
+        ptr = encIndexOf(ord);
+        if (isAvail(ptr) || ptrNe(encPtr_to_objRef(classOf(ptr)), encPtr_to_objRef(methodClass)))
+            continue;
+        if (countOf(ptr) >= cachesInMethod) {
+            orefOfPut(ptr, decodedInMethod, encPtr_to_objRef(nilObj));
+            orefOfPut(ptr, cachesInMethod, encPtr_to_objRef(nilObj));
+        }
+    }
+}
+
 __INLINE__ void fetchMethodState(execState* es)
 {
-    es->litb = (objRef*)addressOf(orefOf(method, literalsInMethod).ptr);
-    es->bytb = ((byte_t*)addressOf(orefOf(method, bytecodesInMethod).ptr)) - 1;
+    encPtr code;
+    /* decode first, since that may collect */
+    code = orefOf(method, decodedInMethod).ptr;
+    if (ptrEq(encPtr_to_objRef(code), encPtr_to_objRef(nilObj)))
+        code = decodeMethod(method);
+    es->lito = orefOf(method, literalsInMethod).ptr;
+    es->litb = (objRef*)addressOf(es->lito);
+    es->byto = code;
+    es->bytb = ((word_t*)addressOf(es->byto)) - 1;
+    es->sndo = orefOf(method, cachesInMethod).ptr;
 }
 
 /*
@@ -4070,7 +6318,7 @@ Pushes one of several "constant" value onto the process stack.  The
 instruction operand denotes which one.  Note that a given context object
 is not "constant" in that the values of its instance variables may
 change.  However, the identity of a given context object is "constant"
-in that it will not change.  See also "bytePushLiteral".
+in that it will not change.  Literals are pushed by "execute".
 */
 bool bytePushConstant(execState* es, int low)
 {
@@ -4120,47 +6368,15 @@ bool bytePushConstant(execState* es, int low)
     return(true);
 }
 
-/*
-Stores the value on the top of the process stack into of one of the
-receiver's instance variables.  The instruction operand denotes which
-one.  Note that this doesn't pop the value from the stack.
-*/
-bool byteAssignInstance(execState* es, int low)
-{
-    receiverAtPut(es, low, stackTop(es));
-    return(true);
-}
-
-/*
-Stores the value on the top of the process stack into of one of the
-method's temporary variables.  The instruction operand denotes which
-one.  Note that this doesn't pop the value from the stack.
-*/
-bool byteAssignTemporary(execState* es, int low)
-{
-    temporaryAtPut(es, low, stackTop(es));
-    return(true);
-}
-
-/*
-Computes the offset within the process stack at which a returned object
-will replace the receiver and arguments of a message.
-*/
-bool byteMarkArguments(execState* es, int low)
-{
-    es->returnPoint = (stackInUse(es) - low) + 1;
-    es->timeSliceCounter++;	/* make sure we do send */
-    return(true);
-}
-
 __INLINE__ encPtr firstLookupClass(execState* es)
 {
+    es->argo = es->pso;
     es->argb = es->psb + (es->returnPoint - 1);
     fetchReceiverState(es);
     return(getClass(es->receiverObject));
 }
 
-encPtr messageToSend = { true,0 };
+encPtr messageToSend = encValueLit(0);
 
 int messTest(encPtr obj)
 {
@@ -4195,42 +6411,89 @@ bool findMethod(encPtr* methodClassLocation)
     return true;
 }
 
-#define cacheSize 211
-
-struct {
+/*
+We cache the results of method lookup in a set-associative table of
+methodCacheSets sets, a power of two, each of methodCacheWays entries.
+The indices of the selector and of the class are mixed by multiplying
+them by odd constants, so that neighbouring indices spread over the
+sets without a division.  A lookup looks at each entry of its set; a
+miss moves the entries of the set along, dropping the last, and puts
+the new one first.  The number of entries is set by -methodcache (see
+gcOption), up to methodCacheLimit, and hits and misses are counted for
+Smalltalk>>methodCacheStatistics.
+*/
+typedef struct {
     encPtr cacheMessage;		/* the message being requested */
     encPtr lookupClass;		/* the class of the receiver */
     encPtr cacheClass;		/* the class of the method */
     encPtr cacheMethod;		/* the method itself */
-} methodCache[cacheSize];// = {};
+} methodCacheEnt;
+
+methodCacheEnt* methodCache = NULL;
+word_t methodCacheSets = 256;
+long methodCacheHits = 0;
+long methodCacheMisses = 0;
+
+int sendCacheEpoch = 0;		/* see "lookupSiteAndEnter" */
+long sendCacheHits = 0;
+
+void methodCacheResize(word_t entries)
+{
+    word_t sets = 1;
+    if (entries > methodCacheLimit)
+        entries = methodCacheLimit;
+    while (sets * methodCacheWays < entries)
+        sets <<= 1;
+    free(methodCache);
+    methodCache = (methodCacheEnt*)calloc(sets * methodCacheWays, sizeof(methodCacheEnt));
+    assert(methodCache != NULL);
+    methodCacheSets = sets;
+}
+
+__INLINE__ methodCacheEnt* methodCacheSet(encPtr messageToSend, encPtr methodClass)
+{
+    word_t hash = (word_t)oteIndexOf(messageToSend) * 0x9E3779B1u +
+        (word_t)oteIndexOf(methodClass) * 0x85EBCA77u;
+    return(methodCache + ((hash ^ (hash >> 16)) & (methodCacheSets - 1)) * methodCacheWays);
+}
 
 void flushCache(encPtr messageToSend, encPtr classPtr)
 {
-    int i;
-    for (i = 0; i != cacheSize; i++)
-        if (ptrEq(encPtr_to_objRef(methodCache[i].cacheMessage), encPtr_to_objRef(messageToSend)))
-            methodCache[i].cacheMessage = nilObj;
+    word_t i;
+    if (methodCache != NULL)
+        for (i = 0; i != methodCacheSets * methodCacheWays; i++)
+            if (ptrEq(encPtr_to_objRef(methodCache[i].cacheMessage), encPtr_to_objRef(messageToSend)))
+                methodCache[i].cacheMessage = nilObj;
+    sendCacheEpoch++;
 }
 
 bool lookupGivenSelector(execState* es, encPtr methodClass)
 {
-    int hash;
+    methodCacheEnt* set;
+    encPtr lookupClass;
+    int way;
     int j;
     encPtr argarray;
     objRef returnedObject;
     if (mselTrace)
         fprintf(stderr, "%d: %s\n", mselTrace--, (char*)addressOf(messageToSend));
     /* look up method in cache */
-    hash = (oteIndexOf(messageToSend) + oteIndexOf(methodClass)) % cacheSize;
-    assert(hash >= 0 && hash < cacheSize);
-    if (ptrEq(encPtr_to_objRef(methodCache[hash].cacheMessage), encPtr_to_objRef(messageToSend)) &&
-        ptrEq(encPtr_to_objRef(methodCache[hash].lookupClass), encPtr_to_objRef(methodClass))) {
-        method = methodCache[hash].cacheMethod;
-        methodClass = methodCache[hash].cacheClass;
+    if (methodCache == NULL)
+        methodCacheResize(methodCacheSets * methodCacheWays);
+    set = methodCacheSet(messageToSend, methodClass);
+    for (way = 0; way != methodCacheWays; way++)
+        if (ptrEq(encPtr_to_objRef(set[way].cacheMessage), encPtr_to_objRef(messageToSend)) &&
+            ptrEq(encPtr_to_objRef(set[way].lookupClass), encPtr_to_objRef(methodClass)))
+            break;
+    if (way != methodCacheWays) {
+        methodCacheHits++;
+        method = set[way].cacheMethod;
+        methodClass = set[way].cacheClass;
         assert(isAvail(method) == false);
     }
     else {
-        methodCache[hash].lookupClass = methodClass;
+        methodCacheMisses++;
+        lookupClass = methodClass;
         if (!findMethod(&methodClass)) {
             /* not found, we invoke a smalltalk method */
             /* to recover */
@@ -4251,9 +6514,12 @@ bool lookupGivenSelector(execState* es, encPtr methodClass)
                 return false;
             }
         }
-        methodCache[hash].cacheMessage = messageToSend;
-        methodCache[hash].cacheMethod = method;
-        methodCache[hash].cacheClass = methodClass;
+        for (way = methodCacheWays - 1; way != 0; way--)
+            set[way] = set[way - 1];
+        set[0].cacheMessage = messageToSend;
+        set[0].lookupClass = lookupClass;
+        set[0].cacheMethod = method;
+        set[0].cacheClass = methodClass;
     }
     return(true);
 }
@@ -4316,6 +6582,7 @@ void pushStateAndEnter(execState* es)
     j = stackInUse(es);
     if ((j + i) > countOf(processStack)) {
         processStack = growProcessStack(j, i);
+        es->pso = processStack;
         es->psb = (objRef*)addressOf(processStack);
         es->pst = (es->psb + j);
         orefOfPut(es->processObject, stackInProcess, encPtr_to_objRef(processStack));
@@ -4331,12 +6598,14 @@ void pushStateAndEnter(execState* es)
     es->cxtb = es->psb;
     /* position 2 : return point */
     ipush(es, encVal_to_objRef(encValueOf(es->returnPoint)));
+    es->argo = processStack;
     es->argb = es->cxtb + (es->returnPoint - 1);
     /* position 3 : method */
     ipush(es, encPtr_to_objRef(method));
     /* position 4 : bytecode counter */
     ipush(es, encVal_to_objRef(encValueOf(es->byteOffset)));
     /* then make space for temporaries */
+    es->tmpo = processStack;
     es->tmpb = es->pst + 1;
     es->pst += methodTempSize(method);
     fetchMethodState(es);
@@ -4357,102 +6626,124 @@ __INLINE__ bool lookupAndEnter(execState* es, encPtr methodClass)
     return(true);
 }
 
+/*
+We keep an inline cache for each send site of a Method in the Method's
+caches Array: sendCacheWays pairs of a receiver class and the Method
+found for it, filled in as the site meets new classes.  A send whose
+receiver's class is in its site's cache goes straight to the Method,
+with a compare for each class before it.  Once a site's pairs are used
+up, further classes go through lookupGivenSelector each time, as do
+sends to super and sends which aren't understood.  The first slot of the
+Array holds the value of sendCacheEpoch when it was last emptied;
+flushCache advances that value, so that every Array is emptied the next
+time it is used after a method is installed or removed.
+*/
+bool lookupSiteAndEnter(execState* es, encPtr methodClass, int site)
+{
+    objRef* cache;
+    encPtr selector;
+    word_t i;
+    word_t slot;
+    if (site == 0)
+        return(lookupAndEnter(es, methodClass));
+    cache = (objRef*)addressOf(es->sndo);
+    if (ptrNe(cache[0], encVal_to_objRef(encValueOf(sendCacheEpoch)))) {
+        for (i = countOf(es->sndo) - 1; i != 0; i--)
+            cache[i] = encPtr_to_objRef(nilObj);
+        cache[0] = encVal_to_objRef(encValueOf(sendCacheEpoch));
+    }
+    slot = 1 + (site - 1) * sendCacheWays * 2;
+    for (i = 0; i != sendCacheWays; i++, slot += 2) {
+        if (ptrEq(cache[slot], encPtr_to_objRef(methodClass))) {
+            if (mselTrace)
+                fprintf(stderr, "%d: %s\n", mselTrace--, (char*)addressOf(messageToSend));
+            sendCacheHits++;
+            method = cache[slot + 1].ptr;
+            if (!lookupWatchSelector(es))
+                return(false);
+            pushStateAndEnter(es);
+            return(true);
+        }
+        if (ptrEq(cache[slot], encPtr_to_objRef(nilObj)))
+            break;
+    }
+    selector = messageToSend;
+    if (!lookupGivenSelector(es, methodClass))
+        return(false);
+    if (i != sendCacheWays && ptrEq(encPtr_to_objRef(messageToSend), encPtr_to_objRef(selector))) {
+        orefOfPut(es->sndo, slot + 1, encPtr_to_objRef(methodClass));
+        orefOfPut(es->sndo, slot + 2, encPtr_to_objRef(method));
+    }
+    if (!lookupWatchSelector(es))
+        return(false);
+    pushStateAndEnter(es);
+    return(true);
+}
+
 /*
 Looks for a Method corresponding to the combination of a prospective
 receiver's class and a symbol denoting some desired behavior.  The
 instruction operand denotes which symbol.  Changes the execution state
 of the interpreter such that the next bytecode executed will be that of
 the Method located, if possible, in an appropriate context.  See also
-"byteSendUnary", "byteSendBinary" and "byteDoSpecial".
+"byteSendUnary", "byteSendBinary" and "byteDoSpecial".  The site
+denotes the inline cache to look in first.
 */
-bool byteSendMessage(execState* es, int low)
+bool byteSendMessage(execState* es, int low, int site)
 {
     encPtr methodClass;
     messageToSend = literalAt(es, low).ptr;
     methodClass = firstLookupClass(es);
-    return(lookupAndEnter(es, methodClass));
+    return(lookupSiteAndEnter(es, methodClass, site));
 }
 
 /*
-Handles certain special cases of messages involving one object.  See
-also "byteSendMessage", "byteSendBinary" and "byteDoSpecial".
+Handles certain special cases of messages involving one object.  The
+interpreter loop answers isNil and notNil itself, since they are so
+common, and comes here for the rest.  See also "byteSendMessage",
+"byteSendBinary" and "byteDoSpecial".
 */
-bool byteSendUnary(execState* es, int low)
+bool byteSendUnary(execState* es, int low, int site)
 {
     encPtr methodClass;
-    /* do isNil and notNil as special cases, since */
-    /* they are so common */
-    if ((!watching) && (low >= 0 && low <= 1)) {
-        switch (low) {
-        case 0: /* isNil */
-            stackTopPut(es, encPtr_to_objRef(
-                ptrEq(stackTop(es), encPtr_to_objRef(nilObj)) ? trueObj : falseObj));
-            return(true);
-        case 1: /* notNil */
-            stackTopPut(es, encPtr_to_objRef(
-                ptrEq(stackTop(es), encPtr_to_objRef(nilObj)) ? falseObj : trueObj));
-            return(true);
-        }
-    }
     es->returnPoint = stackInUse(es);
     messageToSend = unSyms[low];
     methodClass = firstLookupClass(es);
-    return(lookupAndEnter(es, methodClass));
+    return(lookupSiteAndEnter(es, methodClass, site));
 }
 
 /*
-Handles certain special cases of messages involving two objects.  See
-also "byteSendMessage", "byteSendUnary" and "byteDoSpecial".
+Handles certain special cases of messages involving two objects.  The
+interpreter loop first tries the corresponding primitive, which is
+optimized as long as arguments are int and conversions are not necessary
+and overflow does not occur, and comes here when that fails.  See also
+"byteSendMessage", "byteSendUnary" and "byteDoSpecial".
 */
-bool byteSendBinary(execState* es, int low)
+bool byteSendBinary(execState* es, int low, int site)
 {
-    objRef* primargs;
-    objRef returnedObject;
     encPtr methodClass;
-    /* optimized as long as arguments are int */
-    /* and conversions are not necessary */
-    /* and overflow does not occur */
-    if ((!watching) && (low >= 0 && low <= 12)) {
-        if (primTrace)
-            fprintf(stderr, "%d: <%d>\n", primTrace--, low + 60);
-        primargs = es->pst - 1;
-        returnedObject = primitive(low + 60, primargs);
-        if (ptrNe(returnedObject, encPtr_to_objRef(nilObj))) {
-            /* pop arguments off stack , push on result */
-            stackTopFree(es);
-            stackTopPut(es, returnedObject);
-            return(true);
-        }
-    }
     es->returnPoint = stackInUse(es) - 1;
     messageToSend = binSyms[low];
     methodClass = firstLookupClass(es);
-    return(lookupAndEnter(es, methodClass));
+    return(lookupSiteAndEnter(es, methodClass, site));
 }
 
 /*
 Calls a routine to evoke some desired behavior which is not implemented
-in the form of a Method.
+in the form of a Method.  The instruction operand gives the number of
+arguments and the extra operand the number of the primitive.
 */
-bool byteDoPrimitive(execState* es, int low)
+bool byteDoPrimitive(execState* es, int low, int i)
 {
     objRef* primargs;
-    int i;
     objRef returnedObject;
-    /* low gives number of arguments */
-    /* next byte_t is primitive number */
     primargs = (es->pst - low) + 1;
-    /* next byte_t gives primitive number */
-    i = nextByte(es);
     if (primTrace)
         fprintf(stderr, "%d: <%d>\n", primTrace--, i);
     returnedObject = primitive(i, primargs);
     /* pop off arguments */
-    while (low-- > 0) {
-        if (isIndex(stackTop(es)))
-            isVolatilePut(stackTop(es).ptr, false);
+    while (low-- > 0)
         stackTopFree(es);
-    }
     ipush(es, returnedObject);
     return(true);
 }
@@ -4461,11 +6752,8 @@ bool leaveAndAnswer(execState* es, objRef returnedObject)
 {
     es->returnPoint = intValueOf(orefOf(processStack, linkPointer + 2).val);
     linkPointer = intValueOf(orefOf(processStack, linkPointer).val);
-    while (stackInUse(es) >= es->returnPoint) {
-        if (isIndex(stackTop(es)))
-            isVolatilePut(stackTop(es).ptr, false);
+    while (stackInUse(es) >= es->returnPoint)
         stackTopFree(es);
-    }
     ipush(es, returnedObject);
     /* now go restart old routine */
     if (linkPointer) {
@@ -4484,17 +6772,16 @@ operand denotes which operation.  Returning objects changes the
 execution state of the interpreter such that the next bytecode executed
 will be that of the Method which is to process the returned object, if
 possible, in an appropriate context.  See also "byteSendMessage"
-"byteSendUnary" and "byteSendBinary".  Various facilities such as
-cascaded messages and optimized control structures involve tinkering
-with the top of the process stack and the "instruction counter".
-Sending messages to "super" changes the first class to be searched for a
-Method from that of the prospective receiver to the superclass of that
-in which the executing Method is located, if possible.
+"byteSendUnary" and "byteSendBinary".  Sending messages to "super"
+changes the first class to be searched for a Method from that of the
+prospective receiver to the superclass of that in which the executing
+Method is located, if possible; the extra operand denotes the selector.
+The branches and stack shuffling used by cascaded messages and optimized
+control structures are done by "execute" itself.
 */
-bool byteDoSpecial(execState* es, int low)
+bool byteDoSpecial(execState* es, int low, int i)
 {
     objRef returnedObject;
-    int i;
     encPtr methodClass;
     switch (low) {
     case SelfReturn:
@@ -4503,57 +6790,7 @@ bool byteDoSpecial(execState* es, int low)
     case StackReturn:
         returnedObject = ipop(es);
         return(leaveAndAnswer(es, returnedObject));
-    case Duplicate:
-        /* avoid possible subtle bug */
-        returnedObject = stackTop(es);
-        ipush(es, returnedObject);
-        return(true);
-    case PopTop:
-        returnedObject = ipop(es);
-        if (isIndex(returnedObject))
-            isVolatilePut(returnedObject.ptr, false);
-        return(true);
-    case Branch:
-        /* avoid a subtle bug here */
-        i = nextByte(es);
-        es->byteOffset = i;
-        return(true);
-    case BranchIfTrue:
-        returnedObject = ipop(es);
-        i = nextByte(es);
-        if (ptrEq(returnedObject, encPtr_to_objRef(trueObj))) {
-            /* leave nil on stack */
-            es->pst++;
-            es->byteOffset = i;
-        }
-        return(true);
-    case BranchIfFalse:
-        returnedObject = ipop(es);
-        i = nextByte(es);
-        if (ptrEq(returnedObject, encPtr_to_objRef(falseObj))) {
-            /* leave nil on stack */
-            es->pst++;
-            es->byteOffset = i;
-        }
-        return(true);
-    case AndBranch:
-        returnedObject = ipop(es);
-        i = nextByte(es);
-        if (ptrEq(returnedObject, encPtr_to_objRef(falseObj))) {
-            ipush(es, returnedObject);
-            es->byteOffset = i;
-        }
-        return(true);
-    case OrBranch:
-        returnedObject = ipop(es);
-        i = nextByte(es);
-        if (ptrEq(returnedObject, encPtr_to_objRef(trueObj))) {
-            ipush(es, returnedObject);
-            es->byteOffset = i;
-        }
-        return(true);
     case SendToSuper:
-        i = nextByte(es);
         messageToSend = literalAt(es, i).ptr;
         (void)firstLookupClass(es);        /* fix? */
         methodClass = orefOf(method, methodClassInMethod).ptr;
@@ -4571,32 +6808,7 @@ bool byteDoSpecial(execState* es, int low)
     }
 }
 
-typedef bool bytecodeMethod(execState* es, int low);
-
-#define byteVectLob  0
-#define byteVectHib 15
-#define byteVectDom ((byteVectHib + 1) - byteVectLob)
-
-bytecodeMethod* bytecodeVector[byteVectDom] = {
-    /*00*/ &unsupportedByte,
-    /*01*/ &bytePushInstance,
-    /*02*/ &bytePushArgument,
-    /*03*/ &bytePushTemporary,
-    /*04*/ &bytePushLiteral,
-    /*05*/ &bytePushConstant,
-    /*06*/ &byteAssignInstance,
-    /*07*/ &byteAssignTemporary,
-    /*08*/ &byteMarkArguments,
-    /*09*/ &byteSendMessage,
-    /*10*/ &byteSendUnary,
-    /*11*/ &byteSendBinary,
-    /*12*/ &unsupportedByte,
-    /*13*/ &byteDoPrimitive,
-    /*14*/ &unsupportedByte,
-    /*15*/ &byteDoSpecial
-};
-
-encPtr processStack = { true,0 };
+encPtr processStack = encValueLit(0);
 
 int linkPointer = 0;
 
@@ -4604,6 +6816,7 @@ void fetchProcessState(execState* es)
 {
     int j;
     processStack = orefOf(es->processObject, stackInProcess).ptr;
+    es->pso = processStack;
     es->psb = (objRef*)addressOf(processStack);
     j = intValueOf(orefOf(es->processObject, stackTopInProcess).val);
     es->pst = es->psb + (j - 1);
@@ -4619,47 +6832,576 @@ void storeProcessState(execState* es)
 
 word_t traceVect[traceSize];// = {};
 
+execState* execChain = NULL;
+
+/*
+Adds the state of every interpreter activation to the roots of a
+scavenge or of marking, using the given functions to trace a reference
+and the fields of an object.  The process stacks have their fields
+traced in full, since the interpreter stores into them directly rather
+than via orefOfPut.
+*/
+void traceExecRoots(void (*ref)(objRef), void (*fields)(encPtr))
+{
+    execState* es;
+    for (es = execChain; es != NULL; es = es->outer) {
+        ref(encPtr_to_objRef(es->pcso));
+        ref(encPtr_to_objRef(es->pso));
+        fields(es->pso);
+        ref(encPtr_to_objRef(es->cxto));
+        ref(encPtr_to_objRef(es->argo));
+        ref(encPtr_to_objRef(es->tmpo));
+        ref(es->rcvo);
+        ref(encPtr_to_objRef(es->lito));
+        ref(encPtr_to_objRef(es->byto));
+        ref(encPtr_to_objRef(es->sndo));
+    }
+}
+
+/*
+Adds the objects which the host refers to from its own variables to the
+roots of a scavenge or of marking.
+*/
+void traceHostRoots(void (*ref)(objRef))
+{
+    word_t ord;
+    ref(encPtr_to_objRef(symbols));
+    ref(encPtr_to_objRef(method));
+    ref(encPtr_to_objRef(processStack));
+    ref(encPtr_to_objRef(logBuf));
+    ref(encPtr_to_objRef(bwsBuf));
+    ref(encPtr_to_objRef(lowSpaceSem));
+    ref(encPtr_to_objRef(finalSem));
+    for (ord = 0; ord != finalQueue.top; ord++)
+        ref(encPtr_to_objRef(finalQueue.ptrs[ord]));
+    for (ord = 0; ord != 16; ord++)
+        if (oteIndexOf(unSyms[ord]) != 0)
+            ref(encPtr_to_objRef(unSyms[ord]));
+    for (ord = 0; ord != 32; ord++)
+        if (oteIndexOf(binSyms[ord]) != 0)
+            ref(encPtr_to_objRef(binSyms[ord]));
+    for (ord = 0; ord != charTableDom; ord++)
+        if (oteIndexOf(charTable[ord]) != 0)
+            ref(encPtr_to_objRef(charTable[ord]));
+}
+
+__INLINE__ ptrdiff_t offsetIn(encPtr x, void* p)
+{
+    return(((byte_t*)p) - ((byte_t*)addressOf(x)));
+}
+
+__INLINE__ void* addressIn(encPtr x, ptrdiff_t d)
+{
+    return(((byte_t*)addressOf(x)) + d);
+}
+
+/*
+Scavenges and/or compacts at a point where the only host addresses of
+spaces are those kept in interpreter activations.  Each activation's
+addresses are turned into offsets before spaces are moved and back into
+addresses after.  The offsets are kept in the host stack, one frame per
+activation.
+*/
+void safePoint(execState* es)
+{
+    ptrdiff_t pst, cxtb, argb, tmpb, rcvb, litb, bytb;
+    if (es == NULL) {
+        if (scavengeWanted || compactWanted)
+            scavenge();
+        if (compactWanted)
+            compact();
+        return;
+    }
+    pst = es->pst - es->psb;
+    cxtb = offsetIn(es->cxto, es->cxtb);
+    argb = offsetIn(es->argo, es->argb);
+    tmpb = offsetIn(es->tmpo, es->tmpb);
+    rcvb = isIndex(es->rcvo) ? offsetIn(es->rcvo.ptr, es->rcvb) : 0;
+    litb = offsetIn(es->lito, es->litb);
+    bytb = offsetIn(es->byto, es->bytb);
+    safePoint(es->outer);
+    es->psb = (objRef*)addressOf(es->pso);
+    es->pst = es->psb + pst;
+    es->cxtb = (objRef*)addressIn(es->cxto, cxtb);
+    es->argb = (objRef*)addressIn(es->argo, argb);
+    es->tmpb = (objRef*)addressIn(es->tmpo, tmpb);
+    if (isIndex(es->rcvo))
+        es->rcvb = (objRef*)addressIn(es->rcvo.ptr, rcvb);
+    es->litb = (objRef*)addressIn(es->lito, litb);
+    es->bytb = (word_t*)addressIn(es->byto, bytb);
+}
+
+/*
+The interpreter stores into process stacks without going through the
+write barrier, so a stack is passed through the barrier once its
+process stops running.
+*/
+__INLINE__ bool leaveExecute(execState* es, bool ans)
+{
+    writeBarrier(es->pso);
+    execChain = es->outer;
+    return(ans);
+}
+
+/*
+We run a process for up to the given number of instructions, using the
+decoded form of each Method's bytecodes (see "decodeMethod").  The
+instruction pointer and the top of the process stack are kept in locals
+so that the compiler can hold them in registers, and the common
+instructions are carried out here rather than through a call each.
+Pushes and stores use the operand to index the receiver's instance
+variables, the message's arguments (the receiver is the "zeroth"), the
+method's temporaries or its literals; stores don't pop the stack.
+Marking the arguments computes the offset within the process stack at
+which a returned object will replace the receiver and arguments of a
+message.  isNil, notNil, SmallInteger comparisons and arithmetic, the
+branches and stack shuffling of DoSpecial, and the fused pairs of
+instructions are also done inline.
+Everything else goes to the byte functions above, with the locals
+written back to the execution state before and read again after, as
+they are around safe points.
+
+With GCC and Clang each instruction ends by fetching the next and
+jumping straight to its code through a table of label addresses, so
+that every instruction has its own indirect branch for the processor to
+predict.  The checks for the end of the time slice, for wanted
+collections and for tracing are made before each jump; anything out of
+the ordinary goes back to the top of the loop.  Other compilers get the
+same code as the cases of a switch.  Each instruction steps past itself
+by the length which its opcode implies, so that fetching the next one
+need not wait for this one's word to be read.
+*/
+#if defined(__GNUC__) || defined(__clang__)
+#define threadedCode
+#endif
+
+#define execSave() (es.pst = pst, es.byteOffset = (int)(ip - es.bytb))
+#define execLoad() (pst = es.pst, ip = es.bytb + es.byteOffset)
+#define execCall(call) \
+    do { \
+        execSave(); \
+        if (!(call)) \
+            return(leaveExecute(&es, false)); \
+        execLoad(); \
+    } while (0)
+#define execFetch() (w = *ip, op = decodedOp(w), low = decodedLow(w))
+#define execPop() (x = *pst, *pst-- = encPtr_to_objRef(nilObj))
+#define execAnswer(b) \
+    (*pst = encPtr_to_objRef((b) ? trueObj : falseObj))
+
+#ifdef threadedCode
+#define execNext() \
+    do { \
+        if (--es.timeSliceCounter <= 0) \
+            goto sliceDone; \
+        if (scavengeWanted || compactWanted || markWanted || execTrace) \
+            goto service; \
+        execFetch(); \
+        goto *opTable[op]; \
+    } while (0)
+#define execCase(c, l, len) l##Ext: ip++; l: ip += len;
+#define execFused(c, l) l:
+#else
+#define execNext() goto next
+#define execCase(c, l, len) case decodedExtended + c: ip++; case c: ip += len;
+#define execFused(c, l) case decodedFused + c:
+#endif
+
 bool execute(encPtr aProcess, int maxsteps)
 {
     execState es;// = {};
+    objRef* pst;
+    word_t* ip;
+    word_t w;
+    objRef x;
+    long n;
+    int op;
+    int low;
+#ifdef threadedCode
+    static void* opTable[decodedDom] = {
+        /*00*/ &&opUnsupported,
+        /*01*/ &&opPushInstance,
+        /*02*/ &&opPushArgument,
+        /*03*/ &&opPushTemporary,
+        /*04*/ &&opPushLiteral,
+        /*05*/ &&opPushConstant,
+        /*06*/ &&opAssignInstance,
+        /*07*/ &&opAssignTemporary,
+        /*08*/ &&opMarkArguments,
+        /*09*/ &&opSendMessage,
+        /*10*/ &&opSendUnary,
+        /*11*/ &&opSendBinary,
+        /*12*/ &&opUnsupported,
+        /*13*/ &&opDoPrimitive,
+        /*14*/ &&opUnsupported,
+        /*15*/ &&opUnsupported,
+        /*16*/ &&opUnsupported,
+        /*17*/ &&opSelfReturn,
+        /*18*/ &&opStackReturn,
+        /*19*/ &&opUnsupported,
+        /*20*/ &&opDuplicate,
+        /*21*/ &&opPopTop,
+        /*22*/ &&opBranch,
+        /*23*/ &&opBranchIfTrue,
+        /*24*/ &&opBranchIfFalse,
+        /*25*/ &&opAndBranch,
+        /*26*/ &&opOrBranch,
+        /*27*/ &&opSendToSuper,
+        /*28*/ &&opUnsupported,
+        /*29*/ &&opUnsupported,
+        /*30*/ &&opUnsupported,
+        /*31*/ &&opUnsupported,
+        /*32*/ &&opUnsupported,
+        /*33*/ &&opPushInstanceExt,
+        /*34*/ &&opPushArgumentExt,
+        /*35*/ &&opPushTemporaryExt,
+        /*36*/ &&opPushLiteralExt,
+        /*37*/ &&opPushConstantExt,
+        /*38*/ &&opAssignInstanceExt,
+        /*39*/ &&opAssignTemporaryExt,
+        /*40*/ &&opMarkArgumentsExt,
+        /*41*/ &&opSendMessageExt,
+        /*42*/ &&opSendUnaryExt,
+        /*43*/ &&opSendBinaryExt,
+        /*44*/ &&opUnsupported,
+        /*45*/ &&opDoPrimitiveExt,
+        /*46*/ &&opUnsupported,
+        /*47*/ &&opUnsupported,
+        /*48*/ &&opUnsupported,
+        /*49*/ &&opSelfReturnExt,
+        /*50*/ &&opStackReturnExt,
+        /*51*/ &&opUnsupported,
+        /*52*/ &&opDuplicateExt,
+        /*53*/ &&opPopTopExt,
+        /*54*/ &&opBranchExt,
+        /*55*/ &&opBranchIfTrueExt,
+        /*56*/ &&opBranchIfFalseExt,
+        /*57*/ &&opAndBranchExt,
+        /*58*/ &&opOrBranchExt,
+        /*59*/ &&opSendToSuperExt,
+        /*60*/ &&opUnsupported,
+        /*61*/ &&opUnsupported,
+        /*62*/ &&opUnsupported,
+        /*63*/ &&opUnsupported,
+        /*64*/ &&opMarkAndSend,
+        /*65*/ &&opPushArgumentPair,
+        /*66*/ &&opPushConstantBinary,
+        /*67*/ &&opPushArgumentBinary,
+        /*68*/ &&opPushLiteralBinary,
+        /*69*/ &&opBinaryBranchIfFalse,
+        /*70*/ &&opAssignTemporaryPop,
+        /*71*/ &&opPopSelfReturn
+    };
+#endif
 
     es.processObject = aProcess;
     es.timeSliceCounter = maxsteps;
     counterAddress = &es.timeSliceCounter;
+    es.outer = execChain;
+    es.lito = nilObj;
+    es.byto = nilObj;
+    es.sndo = nilObj;
+    execChain = &es;
 
     fetchProcessState(&es);
     fetchLinkageState(&es);
     fetchReceiverState(&es);
     fetchMethodState(&es);
+    if (marking)
+        markWanted = true;
+    (void)sweepStep(sweepBudget);
+    execLoad();
 
-    while (--es.timeSliceCounter > 0) {
-        int low;
-        int high;
-        low = (high = nextByte(&es)) & 0x0F;
-        high >>= 4;
-        if (high == 0) {
-            high = low;
-            low = nextByte(&es);
+#ifndef threadedCode
+next:
+#endif
+    if (--es.timeSliceCounter <= 0)
+        goto sliceDone;
+#ifdef threadedCode
+service:
+#endif
+    if (scavengeWanted || compactWanted || markWanted) {
+        execSave();
+        if (scavengeWanted || compactWanted)
+            safePoint(execChain);
+        if (markWanted)
+            markStep();
+        execLoad();
+    }
+    execFetch();
+    if (execTrace)
+        fprintf(stderr, "%d: %d %d\n", execTrace--, op, low);
+#ifdef threadedCode
+    goto *opTable[op];
+#endif
+    switch (op) {
+    execCase(PushInstance, opPushInstance, 1)
+        *++pst = es.rcvb[low];
+        execNext();
+    execCase(PushArgument, opPushArgument, 1)
+        *++pst = es.argb[low];
+        execNext();
+    execCase(PushTemporary, opPushTemporary, 1)
+        *++pst = es.tmpb[low];
+        execNext();
+    execCase(PushLiteral, opPushLiteral, 1)
+        *++pst = es.litb[low];
+        execNext();
+    execCase(PushConstant, opPushConstant, 1)
+        switch (low) {
+        case 0:
+        case 1:
+        case 2:
+            *++pst = encVal_to_objRef(encValueOf(low));
+            break;
+        case minusOne:
+            *++pst = encVal_to_objRef(encValueOf(-1));
+            break;
+        case nilConst:
+            *++pst = encPtr_to_objRef(nilObj);
+            break;
+        case trueConst:
+            *++pst = encPtr_to_objRef(trueObj);
+            break;
+        case falseConst:
+            *++pst = encPtr_to_objRef(falseObj);
+            break;
+        default:
+            execCall(bytePushConstant(&es, low));
         }
-        if (execTrace)
-            fprintf(stderr, "%d: %d %d\n", execTrace--, high, low);
-        if (high >= byteVectLob && high <= byteVectHib)
-        {
-            bytecodeMethod* byteMethPtr = bytecodeVector[high];
-            if (byteMethPtr) {
-                if (!(*byteMethPtr)(&es, low))
-                    return(false);
-                continue;
+        execNext();
+    execCase(AssignInstance, opAssignInstance, 1)
+        if (isIndex(*pst))
+            writeBarrier(es.rcvo.ptr);
+        es.rcvb[low] = *pst;
+        execNext();
+    execCase(AssignTemporary, opAssignTemporary, 1)
+        if (isIndex(*pst))
+            writeBarrier(es.tmpo);
+        es.tmpb[low] = *pst;
+        execNext();
+    execCase(MarkArguments, opMarkArguments, 1)
+        es.returnPoint = (int)((pst + 1) - es.psb) - low + 1;
+        es.timeSliceCounter++;	/* make sure we do send */
+        execNext();
+    execCase(SendMessage, opSendMessage, 1)
+        execCall(byteSendMessage(&es, low, decodedSite(w)));
+        execNext();
+    execCase(SendUnary, opSendUnary, 1)
+        if (!watching && low <= 1) {
+            /* isNil and notNil */
+            execAnswer(ptrEq(*pst, encPtr_to_objRef(nilObj)) == (low == 0));
+            execNext();
+        }
+        execCall(byteSendUnary(&es, low, decodedSite(w)));
+        execNext();
+    execCase(SendBinary, opSendBinary, 1)
+    sendBinary:
+        if (!watching && low <= 12) {
+            if (low <= 7 && isValue(pst[-1]) && isValue(pst[0])) {
+                n = intValueOf(pst[-1].val);
+                x = pst[0];
+                *pst-- = encPtr_to_objRef(nilObj);
+                switch (low) {
+                case 0: /* + */
+                case 1: /* - */
+                    n = (low == 0) ? n + intValueOf(x.val) : n - intValueOf(x.val);
+                    if (canEmbed(n)) {
+                        *pst = encVal_to_objRef(encValueOf(n));
+                        execNext();
+                    }
+                    *++pst = x;
+                    break;
+                case 2: /* < */
+                    execAnswer(n < intValueOf(x.val));
+                    execNext();
+                case 3: /* > */
+                    execAnswer(n > intValueOf(x.val));
+                    execNext();
+                case 4: /* <= */
+                    execAnswer(n <= intValueOf(x.val));
+                    execNext();
+                case 5: /* >= */
+                    execAnswer(n >= intValueOf(x.val));
+                    execNext();
+                case 6: /* = */
+                    execAnswer(n == intValueOf(x.val));
+                    execNext();
+                case 7: /* ~= */
+                    execAnswer(n != intValueOf(x.val));
+                    execNext();
+                }
+            }
+            if (primTrace)
+                fprintf(stderr, "%d: <%d>\n", primTrace--, low + 60);
+            x = primitive(low + 60, pst - 1);
+            if (ptrNe(x, encPtr_to_objRef(nilObj))) {
+                /* pop arguments off stack , push on result */
+                *pst-- = encPtr_to_objRef(nilObj);
+                *pst = x;
+                execNext();
             }
         }
-        if (!unsupportedByte(&es, low))
-            return(false);
+        execCall(byteSendBinary(&es, low, decodedSite(w)));
+        execNext();
+    execCase(DoPrimitive, opDoPrimitive, 2)
+        execCall(byteDoPrimitive(&es, low, decodedArg(w)));
+        execNext();
+    execCase(decodedSpecial + SelfReturn, opSelfReturn, 1)
+        execCall(byteDoSpecial(&es, SelfReturn, 0));
+        execNext();
+    execCase(decodedSpecial + StackReturn, opStackReturn, 1)
+        execCall(byteDoSpecial(&es, StackReturn, 0));
+        execNext();
+    execCase(decodedSpecial + SendToSuper, opSendToSuper, 2)
+        execCall(byteDoSpecial(&es, SendToSuper, decodedArg(w)));
+        execNext();
+    execCase(decodedSpecial + Duplicate, opDuplicate, 1)
+        x = *pst;
+        *++pst = x;
+        execNext();
+    execCase(decodedSpecial + PopTop, opPopTop, 1)
+        execPop();
+        execNext();
+    execCase(decodedSpecial + Branch, opBranch, 2)
+        ip = es.bytb + decodedArg(w);
+        execNext();
+    execCase(decodedSpecial + BranchIfTrue, opBranchIfTrue, 2)
+        execPop();
+        if (ptrEq(x, encPtr_to_objRef(trueObj))) {
+            /* leave nil on stack */
+            pst++;
+            ip = es.bytb + decodedArg(w);
+        }
+        execNext();
+    execCase(decodedSpecial + BranchIfFalse, opBranchIfFalse, 2)
+        execPop();
+        if (ptrEq(x, encPtr_to_objRef(falseObj))) {
+            /* leave nil on stack */
+            pst++;
+            ip = es.bytb + decodedArg(w);
+        }
+        execNext();
+    execCase(decodedSpecial + AndBranch, opAndBranch, 2)
+        execPop();
+        if (ptrEq(x, encPtr_to_objRef(falseObj))) {
+            *++pst = x;
+            ip = es.bytb + decodedArg(w);
+        }
+        execNext();
+    execCase(decodedSpecial + OrBranch, opOrBranch, 2)
+        execPop();
+        if (ptrEq(x, encPtr_to_objRef(trueObj))) {
+            *++pst = x;
+            ip = es.bytb + decodedArg(w);
+        }
+        execNext();
+    execFused(MarkAndSend, opMarkAndSend)
+        es.returnPoint = (int)((pst + 1) - es.psb) - low + 1;
+        ip += 2;
+        execCall(byteSendMessage(&es, decodedArg(w), decodedSite(w)));
+        execNext();
+    execFused(PushArgumentPair, opPushArgumentPair)
+        pst[1] = es.argb[low];
+        pst[2] = es.argb[decodedArg(w)];
+        pst += 2;
+        ip += 2;
+        execNext();
+    execFused(PushConstantBinary, opPushConstantBinary)
+        switch (low) {
+        case minusOne:
+            *++pst = encVal_to_objRef(encValueOf(-1));
+            break;
+        case nilConst:
+            *++pst = encPtr_to_objRef(nilObj);
+            break;
+        case trueConst:
+            *++pst = encPtr_to_objRef(trueObj);
+            break;
+        case falseConst:
+            *++pst = encPtr_to_objRef(falseObj);
+            break;
+        default:
+            *++pst = encVal_to_objRef(encValueOf(low));
+        }
+        ip += 2;
+        low = decodedArg(w);
+        goto sendBinary;
+    execFused(PushArgumentBinary, opPushArgumentBinary)
+        *++pst = es.argb[low];
+        ip += 2;
+        low = decodedArg(w);
+        goto sendBinary;
+    execFused(PushLiteralBinary, opPushLiteralBinary)
+        *++pst = es.litb[low];
+        ip += 2;
+        low = decodedArg(w);
+        goto sendBinary;
+    execFused(BinaryBranchIfFalse, opBinaryBranchIfFalse)
+        if (watching || !isValue(pst[-1]) || !isValue(pst[0])) {
+            /* let the BranchIfFalse run by itself */
+            ip += 1;
+            goto sendBinary;
+        }
+        n = intValueOf(pst[-1].val);
+        x = pst[0];
+        *pst-- = encPtr_to_objRef(nilObj);
+        switch (low) {
+        case 2: /* < */
+            n = n < intValueOf(x.val);
+            break;
+        case 3: /* > */
+            n = n > intValueOf(x.val);
+            break;
+        case 4: /* <= */
+            n = n <= intValueOf(x.val);
+            break;
+        case 5: /* >= */
+            n = n >= intValueOf(x.val);
+            break;
+        case 6: /* = */
+            n = n == intValueOf(x.val);
+            break;
+        default: /* ~= */
+            n = n != intValueOf(x.val);
+        }
+        if (n) {
+            *pst-- = encPtr_to_objRef(nilObj);
+            ip += 3;
+        }
+        else {
+            /* leave nil on stack */
+            *pst = encPtr_to_objRef(nilObj);
+            ip = es.bytb + decodedArg(w);
+        }
+        execNext();
+    execFused(AssignTemporaryPop, opAssignTemporaryPop)
+        if (isIndex(*pst))
+            writeBarrier(es.tmpo);
+        es.tmpb[low] = *pst;
+        *pst-- = encPtr_to_objRef(nilObj);
+        ip += 2;
+        execNext();
+    execFused(PopSelfReturn, opPopSelfReturn)
+        *pst-- = encPtr_to_objRef(nilObj);
+        ip += 2;
+        execCall(byteDoSpecial(&es, SelfReturn, 0));
+        execNext();
+    default:
+#ifdef threadedCode
+    opUnsupported:
+#endif
+        execSave();
+        (void)unsupportedByte(&es, low);
+        return(leaveExecute(&es, false));
     }
 
+sliceDone:
+    execSave();
     orefOfPut(processStack, linkPointer + 4, encVal_to_objRef(encValueOf(es.byteOffset)));
     storeProcessState(&es);
 
-    return(true);
+    return(leaveExecute(&es, true));
 }
 
 void makeInitialImage(void)
@@ -4796,9 +7538,6 @@ void goDoIt(const char* text)
     /* now go execute it */
     while (execute(process, 1 << 14))
         fprintf(stderr, ".");
-
-    /* get rid of unwanted process */
-    isVolatilePut(process, false);
 }
 
 int main_1(int argc, char* argv[])
@@ -4886,6 +7625,7 @@ int main_2(int argc, char* argv[])
     warmObjectTableTwo();
 
     initCommonSymbols();
+    forgetDecoded();
 
     firstProcess = globalValue("systemProcess");
     if (ptrEq(encPtr_to_objRef(firstProcess), encPtr_to_objRef(nilObj))) {
@@ -4948,6 +7688,102 @@ void sysWarn(const char* s1, const char* s2)
 #endif
 }
 
+/*
+Prints a census (see takeCensus) of the image in the given file, which
+is only read, not run:  the bytes and instances of each class and the
+totals.
+*/
+int main_3(int argc, char* argv[])
+{
+    FILE* fp;
+    censusEnt* tab;
+    word_t i, n;
+    encPtr cls, name;
+    long count = 0;
+    long bytes = 0;
+    const char* p = "snapshot";
+
+    if (argc != 1)
+        p = argv[1];
+    warmObjectTableOne();
+    fp = fopen(p, "rb");
+    if (fp == NULL) {
+        sysError("cannot open image", p);
+        return(1);
+    }
+    if (ptrNe(encPtr_to_objRef(imageRead(fp)), encPtr_to_objRef(trueObj))) {
+        sysError("cannot read image", p);
+        return(1);
+    }
+    (void)fclose(fp);
+    warmObjectTableTwo();
+
+    n = takeCensus(&tab);
+    (void)printf("%12s %10s  %s\n", "bytes", "instances", "class");
+    for (i = 0; i != n; i++) {
+        cls = encIndexOf(tab[i].cls);
+        name = nilObj;
+        if (!isAvail(cls) && isObjRefs(cls) && countOf(cls) >= nameInClass)
+            name = orefOf(cls, nameInClass).ptr;
+        if (isIndex(encPtr_to_objRef(name)) && !isAvail(name) && !isObjRefs(name) && countOf(name) > 0)
+            (void)printf("%12.0f %10.0f  %.*s\n", (double)tab[i].bytes, (double)tab[i].count,
+                (int)strnlen((char*)addressOf(name), countOf(name)), (char*)addressOf(name));
+        else if (ptrEq(encPtr_to_objRef(cls), encPtr_to_objRef(nilObj)))
+            (void)printf("%12.0f %10.0f  nil\n", (double)tab[i].bytes, (double)tab[i].count);
+        else
+            (void)printf("%12.0f %10.0f  (object %u)\n", (double)tab[i].bytes, (double)tab[i].count,
+                (unsigned)tab[i].cls);
+        count += tab[i].count;
+        bytes += tab[i].bytes;
+    }
+    (void)printf("%12.0f %10.0f  total in %u classes\n", (double)bytes, (double)count, (unsigned)n);
+    free(tab);
+    return(0);
+}
+
+/*
+Memory management can be tuned from the command line by options which
+come before -c or -w, each followed by a number:
+    -gcpause n    objects traced per increment of marking (0 disables
+                  incremental marking)
+    -gcthreads n  threads used to finish marking and to sweep
+    -gccompact n  percentage of arena space left free by sweeping
+                  beyond which spaces are compacted (0 disables)
+    -gcmaxheap n  address units which spaces may hold before space is
+                  low (0 means no limit)
+    -gctrigger n  address units allocated after which marking starts
+                  (0 means only when the object table runs low)
+    -gcgrowth n   percentage by which the object table grows
+    -gclog n      1 to log each pause and sweep on stderr (see gcEnd)
+    -methodcache n  entries in the global method cache, rounded up to a
+                  power of two, up to 1m (see methodCacheResize)
+Sizes may be followed by k, m or g.  A negative value, or one too large
+for its setting, leaves the setting alone.
+Returns true if the option was recognized.
+*/
+bool gcOption(const char* name, const char* value)
+{
+    word_t which;
+    char* end;
+    long n;
+    for (which = 1; gcSettingNames[which] != NULL; which++)
+        if (streq(name, gcSettingNames[which])) {
+            n = (long)strtoll(value, &end, 10);
+            if (n < 0 || n > (INT64_MAX >> 30))
+                return(true);	/* left alone, as by gcSettingPut */
+            switch (*end) {
+            case 'g': case 'G': n <<= 10;
+                /* fall through */
+            case 'm': case 'M': n <<= 10;
+                /* fall through */
+            case 'k': case 'K': n <<= 10;
+            }
+            (void)gcSettingPut(which, n);
+            return(true);
+        }
+    return(false);
+}
+
 #ifdef L2_SMALLTALK_EMBEDDED
 int L2_SMALLTALK_MAIN(int argc, char* argv[])
 #else
@@ -4956,9 +7792,14 @@ int main(int argc, char* argv[])
 {
     //argc = 3;
     //argv = (char*[]){"foo", "-c", "BaseLibrary.smalltalk"};
-    //printf("sizeof(otbEnt) = %d, sizeof(ot2Ent) = %d\n", sizeof(otbEnt), sizeof(ot2Ent));
+    //printf("sizeof(otbEnt) = %d\n", sizeof(otbEnt));
     int ans = 1;
     logTag = fopen("transcript", "ab");
+    while (argc > 2 && gcOption(argv[1], argv[2])) {
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
     if (argc > 1 && streq(argv[1], "-c")) {
         argv[1] = argv[0];
         argc--;
@@ -4971,6 +7812,15 @@ int main(int argc, char* argv[])
         argv++;
         ans = main_2(argc, argv);
     }
+    if (argc > 1 && streq(argv[1], "-census")) {
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+        ans = main_3(argc, argv);
+        if (logTag != NULL)
+            (void)fclose(logTag);
+        return(ans);
+    }
 #if 0
     fprintf(stderr, "%s?\n",
         (char*)addressOf(orefOf(encIndexOf(100), nameInClass).ptr));